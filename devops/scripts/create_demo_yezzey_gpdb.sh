@@ -18,6 +18,9 @@ set -ex
             gpconfig -c yezzey.yproxy_socket -v "/tmp/yproxy.sock"
             psql -c "ALTER SYSTEM SET yezzey.use_gpg_crypto TO false"
             gpconfig -c yezzey.use_otm_feature -v true
+            # yezzey-autooffload test waits for the worker
+            gpconfig -c yezzey.autooffload -v on
+            gpconfig -c yezzey.autooffload_naptime -v 5
             gpconfig -c yezzey.use_gpg_crypto -v false
 
             gpstop -a -i && gpstart -a
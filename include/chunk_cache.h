@@ -0,0 +1,67 @@
+#pragma once
+
+#include "chunkinfo.h"
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Segment-local on-disk cache of external storage chunks.
+ *
+ * Chunks are immutable once written (their path contains modcount and lsn),
+ * so cached copy never needs invalidation; obsolete copies simply age out.
+ * Cache is bounded by yezzey.disk_cache_size and evicted in LRU order,
+ * recency being tracked via file mtime, so that all backends of a segment
+ * share it without any shared memory. Each backend estimates cache size
+ * from its last directory scan plus chunks it has added since, and scans
+ * again only when the estimate goes over the limit or gets stale.
+ */
+class ChunkDiskCache {
+public:
+  /* is cache enabled and is chunk small enough to be cached */
+  static bool enabled(const ChunkInfo &ci);
+
+  /* is chunk present in cache */
+  static bool contains(const ChunkInfo &ci);
+
+  /* open cached chunk for reading, positioned at start_off; -1 on miss */
+  static int open(const ChunkInfo &ci, size_t start_off);
+
+  /* forget all cached copies of external path */
+  static void evict(const std::string &x_path);
+
+  /* account chunk put into cache, enforcing limit when it may be hit */
+  static void added(uint64_t size);
+
+  /* unlink least recently used files until cache fits its limit */
+  static void enforceLimit();
+
+  static std::string directory();
+  static std::string path(const ChunkInfo &ci);
+};
+
+/* Tee chunk bytes received from yproxy into the cache */
+class ChunkCacheFiller {
+public:
+  explicit ChunkCacheFiller(const ChunkInfo &ci);
+  /* drops incomplete file, if any */
+  ~ChunkCacheFiller();
+
+  ChunkCacheFiller(const ChunkCacheFiller &) = delete;
+  ChunkCacheFiller &operator=(const ChunkCacheFiller &) = delete;
+
+  /* failures only disable caching of this chunk */
+  void append(const char *buffer, size_t amount);
+
+  /* publish chunk in cache, once all its bytes are received */
+  void complete();
+
+private:
+  void abort();
+
+  std::string path_;
+  std::string tmp_path_;
+  int fd_{-1};
+  uint64_t expected_{0};
+  uint64_t written_{0};
+};
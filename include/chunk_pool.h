@@ -0,0 +1,66 @@
+#ifndef YEZZEY_CHUNK_POOL_H
+#define YEZZEY_CHUNK_POOL_H
+
+#include "pg.h"
+
+#ifdef __cplusplus
+#define EXTERNC extern "C"
+#else
+#define EXTERNC
+#endif
+
+/*
+ * Segment-wide shared memory pool of external storage chunk extents.
+ *
+ * Chunks are cut into extents of YEZZEY_CHUNK_POOL_EXTENT bytes, keyed by
+ * (x_path, in-chunk offset). Backends scanning the same offloaded relation
+ * concurrently share downloaded extents, and only one of them fetches an
+ * extent at a time: others sleep, interruptibly, until the loader
+ * publishes or abandons the slot. No lock is held across downloads.
+ * Pool is sized by yezzey.chunk_pool_size, 0 disables it.
+ */
+#define YEZZEY_CHUNK_POOL_EXTENT (1024 * 1024)
+
+/* reserve shared memory and locks, called from _PG_init or request hook */
+EXTERNC void YezzeyChunkPoolShmemRequest(void);
+
+/* allocate or attach to the pool, called from shmem_startup_hook */
+EXTERNC void YezzeyChunkPoolShmemInit(void);
+
+#ifdef __cplusplus
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class ChunkPool {
+public:
+  enum class Result {
+    /* extent copied into caller buffer */
+    Hit,
+    /* caller must load the extent and then publish() or abandon() it */
+    Claimed,
+    /* pool can not serve this extent, read it directly */
+    Bypass,
+  };
+
+  static bool enabled();
+
+  /*
+   * Look extent up, waiting for concurrent loader if any. On miss a slot
+   * is reserved for the caller, who must publish or abandon it, also when
+   * erroring out. Slot claimed by exiting backend is abandoned on exit.
+   */
+  static Result acquire(const std::string &x_path, uint64_t offset,
+                        size_t len, char *buffer, int *slot);
+
+  /* store loaded extent and wake up waiters */
+  static void publish(int slot, const char *buffer, size_t len);
+
+  /* loading failed, release reserved slot */
+  static void abandon(int slot);
+};
+
+#endif
+
+#endif /* YEZZEY_CHUNK_POOL_H */
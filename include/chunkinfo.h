@@ -2,21 +2,60 @@
 
 #include "pg.h"
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * External storage paths of chunks read by one virtual index scan. Chunk
+ * path is <prefix>_DY_<modcount>_xlog_<lsn>, and prefix only differs
+ * between chunks written under different relation names, so prefixes are
+ * interned and chunk keeps prefix id, its path is put together when it is
+ * requested. Paths not following the scheme, e.g. of chunks reused from
+ * backups, are kept whole. Paths always come from virtual index rows, so
+ * chunks of renamed relation are read at names they were written with.
+ */
+class ChunkPaths {
+public:
+  /* id of path of chunk with given modcount and lsn */
+  uint32_t intern(const char *x_path, size_t len, int64_t modcount,
+                  XLogRecPtr lsn);
+  std::string path(uint32_t id, int64_t modcount, XLogRecPtr lsn) const;
+
+private:
+  /* id of path kept whole */
+  static const uint32_t kWholePath = 1u << 31;
+
+  std::vector<std::string> prefixes_;
+  std::unordered_map<std::string, uint32_t> prefix_ids_;
+  /* prefix of last interned path, valid if prefixes_ is not empty */
+  uint32_t last_prefix_{0};
+  std::vector<std::string> whole_;
+};
 
 struct ChunkInfo {
   XLogRecPtr lsn;
   int64_t modcount;
-  std::string x_path;
   uint64_t size;
   uint64_t start_off;
   bool enc;
   bool kek; // whether key encryption key was used
 
+  /* paths of chunks scanned together with this one, and id of ours */
+  std::shared_ptr<const ChunkPaths> paths;
+  uint32_t path_id{0};
+
   ChunkInfo() {}
 
-  ChunkInfo(XLogRecPtr lsn, int64_t modcount, const char *x_path, uint64_t size,
-            uint64_t start_off, bool enc, bool kek)
-      : lsn(lsn), modcount(modcount), x_path(x_path), size(size),
-        start_off(start_off), enc(enc), kek(kek) {}
-};
\ No newline at end of file
+  ChunkInfo(XLogRecPtr lsn, int64_t modcount,
+            std::shared_ptr<const ChunkPaths> paths, uint32_t path_id,
+            uint64_t size, uint64_t start_off, bool enc, bool kek)
+      : lsn(lsn), modcount(modcount), size(size), start_off(start_off),
+        enc(enc), kek(kek), paths(std::move(paths)), path_id(path_id) {}
+
+  /* external storage path */
+  std::string x_path() const { return paths->path(path_id, modcount, lsn); }
+};
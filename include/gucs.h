@@ -14,5 +14,47 @@ extern int multipart_threshold;
 
 /* Y-PROXY */
 extern char *yproxy_socket;
+extern int yezzey_read_ahead_chunks;
+extern int yezzey_read_timeout;
+extern bool yezzey_hedge_reads;
+extern bool yezzey_fill_read_buffer;
+extern bool yezzey_yproxy_keepalive;
+extern bool yezzey_yproxy_multiplex;
+extern int yezzey_yproxy_shm_ring_size;
+
+typedef enum {
+  YEZZEY_IO_ENGINE_SYSCALL,
+  YEZZEY_IO_ENGINE_URING,
+} YezzeyIOEngine;
+
+extern int yezzey_io_engine;
+extern int yezzey_write_buffer_size;
+extern int yezzey_offload_transfer_size;
+extern int yezzey_offload_parallel;
+extern int yezzey_load_parallel;
+extern int yezzey_offload_checkpoint_size;
+extern int yezzey_compaction_target_size;
+
+/* auto-offload worker */
+extern char *yezzey_autooffload_database;
+extern int yezzey_autooffload_naptime;
+extern int yezzey_autooffload_window_start;
+extern int yezzey_autooffload_window_end;
+extern int yezzey_autooffload_max_relations;
+extern int yezzey_autooffload_parallel;
+extern bool yezzey_autooffload_compact;
+
+/* local chunk cache */
+extern int yezzey_disk_cache_size;
+extern char *yezzey_disk_cache_path;
+
+/* shared memory chunk pool */
+extern int yezzey_chunk_pool_size;
+
+/* segment-wide external storage traffic limits */
+extern int yezzey_background_bandwidth_limit;
+extern int yezzey_background_iops_limit;
+extern int yezzey_foreground_bandwidth_limit;
+extern int yezzey_foreground_iops_limit;
 
 #endif /* YEZZEY_GUCS_H */
\ No newline at end of file
@@ -30,6 +30,14 @@ struct YIO {
   /* order of external storage chunk to read */
   std::vector<ChunkInfo> order_;
 
+  /* writes not yet sent to yproxy */
+  std::vector<char> write_buf_;
+  /*
+   * Buffered writes were lost, as was Put they belong to. Every later
+   * write, flush and close fails.
+   */
+  bool write_failed_{false};
+
   // constructor
   YIO(std::shared_ptr<IOadv> adv, ssize_t segindx, ssize_t modcount,
       const std::string &storage_path);
@@ -37,6 +45,10 @@ struct YIO {
   /* read-only case  constructor*/
   YIO(std::shared_ptr<IOadv> adv, ssize_t segindx);
 
+  /*
+   * Completes Put. Owners check io_close() instead, lost writes are an
+   * ERROR here only within running transaction.
+   */
   ~YIO();
 
   off_t total_size() {
@@ -49,14 +61,28 @@ struct YIO {
     return rt;
   }
 
-  // copyable
-  YIO(const YIO &buf) = default;
-  YIO &operator=(const YIO &) = default;
+  /* owns unsent writes, copy would send them twice or not at all */
+  YIO(const YIO &buf) = delete;
+  YIO &operator=(const YIO &) = delete;
 
   bool reader_empty();
 
   bool io_read(char *buffer, size_t *amount);
+  /* read what yproxy has sent, regardless of yezzey.fill_read_buffer */
+  bool io_read_some(char *buffer, size_t *amount);
+  /* see YProxyReader::pollFd */
+  int io_read_poll_fd();
+  /* number of syscalls made by last io_read */
+  int io_read_syscalls();
+  /* position reader on virtual file offset */
+  bool io_seek(int64_t offset);
+  int64_t io_tell();
   bool io_write(char *buffer, size_t *amount);
+  /* send buffered writes to yproxy */
+  bool io_flush();
+  /* see YProxyWriter::writeNonBlocking */
+  bool io_write_nonblocking(const char *buffer, size_t amount, size_t *sent);
+  int io_write_poll_fd();
   bool io_close();
 
   bool use_kek();
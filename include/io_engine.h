@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <utility>
+#include <vector>
+
+/*
+ * Socket I/O used to talk to yproxy. Default engine issues plain
+ * read/write syscalls; io_uring engine (built when liburing is available)
+ * is selected by yezzey.io_engine and falls back to the default one when
+ * io_uring can not be set up at runtime.
+ */
+class IOEngine {
+public:
+  virtual ~IOEngine() = default;
+
+  /* read up to len bytes; 0 on EOF, -1 on error */
+  virtual ssize_t read(int fd, void *buf, size_t len) = 0;
+
+  /* read or write exactly len bytes; 0 on success, -1 on error or EOF */
+  virtual int readFull(int fd, void *buf, size_t len) = 0;
+  virtual int writeFull(int fd, const void *buf, size_t len) = 0;
+
+  /* gather write of all iov buffers; iov is modified */
+  virtual int writevFull(int fd, struct iovec *iov, int iovcnt);
+
+  /*
+   * Send whole messages to several sockets at once. Returns per request
+   * 0 on success or -1 on error.
+   */
+  virtual std::vector<int>
+  writeBatch(const std::vector<std::pair<int, const std::vector<char> *>>
+                 &reqs);
+
+  /* engine selected by yezzey.io_engine */
+  static IOEngine &get();
+};
+
+class SyscallIOEngine : public IOEngine {
+public:
+  ssize_t read(int fd, void *buf, size_t len) override;
+  int readFull(int fd, void *buf, size_t len) override;
+  int writeFull(int fd, const void *buf, size_t len) override;
+};
@@ -0,0 +1,47 @@
+#ifndef YEZZEY_IO_THROTTLE_H
+#define YEZZEY_IO_THROTTLE_H
+
+#include "pg.h"
+
+#ifdef __cplusplus
+#define EXTERNC extern "C"
+#else
+#define EXTERNC
+#endif
+
+/*
+ * Segment-wide limits of external storage traffic, shared by all backends
+ * through token buckets in shared memory.
+ *
+ * Background traffic (offload, load, vacuum deletes) is limited by
+ * yezzey.background_bandwidth_limit and yezzey.background_iops_limit,
+ * query reads of offloaded relations by yezzey.foreground_bandwidth_limit
+ * and yezzey.foreground_iops_limit. Foreground traffic is charged to the
+ * background budget too, so background transfers slow down while queries
+ * read, and never the other way round.
+ */
+
+/* reserve shared memory, called from _PG_init or request hook */
+EXTERNC void YezzeyIOThrottleShmemRequest(void);
+
+/* allocate or attach to buckets, called from shmem_startup_hook */
+EXTERNC void YezzeyIOThrottleShmemInit(void);
+
+#ifdef __cplusplus
+
+#include <cstdint>
+
+enum class YezzeyIOClass {
+  Foreground,
+  Background,
+};
+
+/*
+ * Account bytes and requests of external storage traffic, sleeping while
+ * the class is over its budget.
+ */
+void YezzeyIOThrottle(YezzeyIOClass cls, int64_t bytes, int requests);
+
+#endif
+
+#endif /* YEZZEY_IO_THROTTLE_H */
@@ -30,6 +30,27 @@ const char MessageTypeDelete = 47;
 const char MessageTypeCollectObsolete = 64;
 const char MessageTypeDeleteObsolete = 65;
 
+/*
+ * Multiplexed connection envelope: proto header, stream id and a whole
+ * regular message (with its own length). Stream id 0 is never used.
+ */
+const char MessageTypeStreamFrame = 70;
+/*
+ * Sent by backend when it is done with a stream before the stream ended:
+ * yproxy stops serving the request and drops its further messages.
+ * Close of a stream which has already ended is ignored.
+ */
+const char MessageTypeStreamClose = 73;
+
+/*
+ * Shared memory ring transport. RingSetup carries ring capacity, memfd
+ * of the ring and eventfd signalled on freed ring space are passed along
+ * with it via SCM_RIGHTS. RingData announces that given number of payload
+ * bytes were put into the ring.
+ */
+const char MessageTypeRingSetup = 71;
+const char MessageTypeRingData = 72;
+
 const size_t MSG_HEADER_SIZE = 8;
 const size_t PROTO_HEADER_SIZE = 4;
 const size_t OFFSET_SZ = 8;
@@ -68,3 +89,27 @@ protected:
   ssize_t cursor;
   std::vector<char> data;
 };
+
+/* CopyData message up to its payload: length, proto header, amount */
+const size_t COPY_DATA_HEADER_SIZE = MSG_HEADER_SIZE + PROTO_HEADER_SIZE + UINT64_SZ;
+
+/*
+ * Encode CopyData header for payload of given size into buf, which must
+ * hold COPY_DATA_HEADER_SIZE bytes. Payload itself is sent right after it,
+ * without copying into a message buffer.
+ */
+void EncodeCopyDataHeader(char *buf, uint64_t amount);
+
+/* wrap message into stream frame */
+std::vector<char> ConstructStreamFrame(uint64_t stream_id,
+                                       const std::vector<char> &msg);
+
+/* ask yproxy to stop serving stream */
+std::vector<char> ConstructStreamClose(uint64_t stream_id);
+
+/*
+ * Parse stream frame body (message without length header). On success
+ * stream id and offset of wrapped message within body are returned.
+ */
+bool ParseStreamFrame(const std::vector<char> &body, uint64_t *stream_id,
+                      size_t *msg_offset);
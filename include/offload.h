@@ -18,4 +18,6 @@ EXTERNC void
 yezzey_offload_relation_internal(Oid reloid, bool remove_locally,
                                  const char *external_storage_path);
 
+EXTERNC int64 yezzey_compact_relation_internal(Oid reloid);
+
 #endif /* YEZZEY_OFFLOAD_H */
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Sliding window of chunk request latencies (time to first byte, in ms),
+ * used to derive hedging threshold for external storage reads.
+ */
+class LatencyTracker {
+public:
+  explicit LatencyTracker(size_t capacity = 128) : capacity_(capacity) {}
+
+  void add(double ms) {
+    if (samples_.size() < capacity_) {
+      samples_.push_back(ms);
+    } else {
+      samples_[next_] = ms;
+    }
+    next_ = (next_ + 1) % capacity_;
+  }
+
+  size_t size() const { return samples_.size(); }
+
+  /* q-th quantile (0 <= q <= 1) of window, nearest rank; 0 if empty */
+  double percentile(double q) const {
+    if (samples_.empty()) {
+      return 0;
+    }
+    auto sorted = samples_;
+    size_t rank = (size_t)(q * sorted.size());
+    if (rank >= sorted.size()) {
+      rank = sorted.size() - 1;
+    }
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+  }
+
+private:
+  size_t capacity_;
+  size_t next_{0};
+  std::vector<double> samples_;
+};
+
+/*
+ * Exponential backoff with full jitter: delay before retry number
+ * `attempt` (starting at 1) is uniform in [0, min(cap, base * 2^attempt)).
+ * `rnd` is caller-supplied random value, to keep this deterministic.
+ */
+inline uint64_t backoffDelayMs(int attempt, uint64_t base_ms, uint64_t cap_ms,
+                               uint64_t rnd) {
+  uint64_t ceil = cap_ms;
+  if (attempt < 32 && (base_ms << attempt) < cap_ms) {
+    ceil = base_ms << attempt;
+  }
+  if (ceil == 0) {
+    return 0;
+  }
+  return rnd % ceil;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * Header of single-producer single-consumer byte ring placed in memory
+ * shared by backend and yproxy. Counters grow monotonically, position in
+ * data area is counter modulo capacity.
+ */
+struct ShmRingHeader {
+  /* bytes ever written by producer */
+  std::atomic<uint64_t> head;
+  /* bytes ever consumed by consumer */
+  std::atomic<uint64_t> tail;
+  uint64_t capacity;
+};
+
+class ShmRing {
+public:
+  static size_t mappedSize(size_t capacity) {
+    return sizeof(ShmRingHeader) + capacity;
+  }
+
+  /* base points to mappedSize() bytes */
+  explicit ShmRing(void *base)
+      : hdr_(static_cast<ShmRingHeader *>(base)),
+        data_(static_cast<char *>(base) + sizeof(ShmRingHeader)) {}
+
+  /* called by side which creates the ring */
+  void init(size_t capacity) {
+    hdr_->head.store(0);
+    hdr_->tail.store(0);
+    hdr_->capacity = capacity;
+  }
+
+  size_t capacity() const { return hdr_->capacity; }
+
+  size_t readable() const {
+    return hdr_->head.load(std::memory_order_acquire) -
+           hdr_->tail.load(std::memory_order_relaxed);
+  }
+
+  size_t writable() const {
+    return hdr_->capacity - (hdr_->head.load(std::memory_order_relaxed) -
+                             hdr_->tail.load(std::memory_order_acquire));
+  }
+
+  /* producer: copy in as much as fits, returns bytes written */
+  size_t write(const char *buf, size_t len) {
+    const auto n = std::min(len, writable());
+    const auto head = hdr_->head.load(std::memory_order_relaxed);
+    copy(head, n, [&](size_t pos, size_t off, size_t cnt) {
+      memcpy(data_ + pos, buf + off, cnt);
+    });
+    hdr_->head.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  /* consumer: copy out as much as available, returns bytes read */
+  size_t read(char *buf, size_t len) {
+    const auto n = std::min(len, readable());
+    const auto tail = hdr_->tail.load(std::memory_order_relaxed);
+    copy(tail, n, [&](size_t pos, size_t off, size_t cnt) {
+      memcpy(buf + off, data_ + pos, cnt);
+    });
+    hdr_->tail.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+private:
+  /* split n bytes starting at counter into at most two contiguous parts */
+  template <typename F> void copy(uint64_t counter, size_t n, F f) {
+    const size_t pos = counter % hdr_->capacity;
+    const size_t first = std::min(n, (size_t)(hdr_->capacity - pos));
+    if (first > 0) {
+      f(pos, 0, first);
+    }
+    if (n > first) {
+      f(0, first, n - first);
+    }
+  }
+
+  ShmRingHeader *hdr_;
+  char *data_;
+};
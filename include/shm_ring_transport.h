@@ -0,0 +1,53 @@
+#pragma once
+
+#include "shm_ring.h"
+
+#include <memory>
+#include <sys/types.h>
+
+/*
+ * Payload transport through memfd-backed ring shared with yproxy.
+ * Ring is handed over to yproxy on connection socket, which then carries
+ * only control messages: RingData announcements of payload put into
+ * the ring, and regular protocol messages.
+ *
+ * An eventfd goes along with the ring. Data flows one way on a connection,
+ * and consumer signals eventfd whenever it frees ring space, so producer
+ * facing full ring sleeps on it instead of polling the ring.
+ */
+class ShmRingTransport {
+public:
+  /* create ring and pass it to yproxy; nullptr if yproxy refused it */
+  static std::unique_ptr<ShmRingTransport> negotiate(int sock,
+                                                     size_t capacity);
+
+  ShmRingTransport(int memfd, int eventfd, void *base, size_t mapped);
+  ~ShmRingTransport();
+
+  ShmRingTransport(const ShmRingTransport &) = delete;
+  ShmRingTransport &operator=(const ShmRingTransport &) = delete;
+
+  /* producer side: push payload through ring, announcing it on sock */
+  bool send(int sock, const char *buffer, size_t len);
+
+  /*
+   * Consumer side: read payload announced by yproxy. Returns number of
+   * bytes, 0 if yproxy sent something else than payload, -1 on failure.
+   */
+  ssize_t receive(int sock, char *buffer, size_t len);
+
+  /* announced payload is still in the ring, socket need not be waited */
+  bool hasPending() const { return pending_ > 0; }
+
+private:
+  /* wait until consumer frees ring space; false if yproxy reported error */
+  bool waitSpace(int sock);
+
+  int memfd_{-1};
+  int eventfd_{-1};
+  void *base_{nullptr};
+  size_t mapped_{0};
+  ShmRing ring_;
+  /* bytes announced by peer, not consumed yet */
+  uint64_t pending_{0};
+};
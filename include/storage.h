@@ -26,6 +26,7 @@ typedef struct yezzeyChunkMeta {
 #include "io_adv.h"
 #include "types.h"
 #include <memory>
+#include <vector>
 
 std::string getlocalpath(const std::string &local_path, int segno);
 bool ensureFilepathLocal(const std::string &filepath);
@@ -35,6 +36,29 @@ int offloadRelationSegmentPath(Relation aorel, std::shared_ptr<IOadv> ioadv,
                                int64 modcount, int64 logicalEof,
                                const std::string &external_storage_path);
 Oid resolveTablespaceOidByName(const std::string &tablespacename);
+
+struct SegmentOffloadTask {
+  int segno;
+  int64 modcount;
+  int64 logicalEof;
+};
+
+/*
+ * Offload segment files of relation. With yezzey.offload_parallel > 1
+ * several files are uploaded concurrently over their own yproxy
+ * connections.
+ */
+void offloadRelationSegments(Relation aorel,
+                             const std::vector<SegmentOffloadTask> &tasks,
+                             const char *external_storage_path);
+
+/*
+ * Merge runs of adjacent external storage chunks smaller than
+ * yezzey.compaction_target_size into objects of up to that size. Returns
+ * number of chunks merged.
+ */
+int64 compactRelationSegments(Relation aorel,
+                              const std::vector<SegmentOffloadTask> &tasks);
 #endif
 
 EXTERNC void offloadRelationSegment(Relation aorel, int segno, int64 modcount,
@@ -45,6 +69,14 @@ EXTERNC void loadRelationSegment(Relation aorel, Oid loadSpcOid,
                                  Oid orig_relnode, int segno,
                                  const char *dest_path);
 
+/*
+ * Load segment files of relation. With yezzey.load_parallel > 1 several
+ * files are downloaded concurrently, each one is WAL-logged in order.
+ */
+EXTERNC void loadRelationSegments(Relation aorel, Oid loadSpcOid,
+                                  Oid orig_relnode, const int *segnos,
+                                  int nsegnos, const char *dest_path);
+
 EXTERNC int statRelationSpaceUsage(Relation aorel, int segno, int64 modcount,
                                    int64 logicalEof, size_t *local_bytes,
                                    size_t *local_commited_bytes,
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+
+/*
+ * Token bucket in debt form: consumer takes tokens first and then waits
+ * until the bucket is refilled to non-negative level, so request of any
+ * size is admitted. Bucket holds at most one second of its rate. State is
+ * plain data, to be placed in shared memory under caller's lock.
+ * Rate is in tokens per second, rate <= 0 means no limit.
+ */
+struct TokenBucket {
+  double tokens;
+  double last_ms;
+};
+
+inline void tokenBucketInit(TokenBucket *b, double now_ms) {
+  b->tokens = 0;
+  b->last_ms = now_ms;
+}
+
+/* add tokens accumulated since last refill */
+inline void tokenBucketRefill(TokenBucket *b, double now_ms, double rate) {
+  if (now_ms <= b->last_ms) {
+    return;
+  }
+  if (rate > 0) {
+    b->tokens =
+        std::min(rate, b->tokens + (now_ms - b->last_ms) * rate / 1000);
+  } else {
+    b->tokens = 0;
+  }
+  b->last_ms = now_ms;
+}
+
+/* take tokens, going at most max_debt below zero; max_debt < 0 - no bound */
+inline void tokenBucketTake(TokenBucket *b, double amount, double max_debt) {
+  b->tokens -= amount;
+  if (max_debt >= 0) {
+    b->tokens = std::max(b->tokens, -max_debt);
+  }
+}
+
+/* time until bucket is out of debt, 0 if it is not in debt */
+inline double tokenBucketWaitMs(const TokenBucket *b, double rate) {
+  if (rate <= 0 || b->tokens >= 0) {
+    return 0;
+  }
+  return -b->tokens * 1000 / rate;
+}
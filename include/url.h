@@ -2,6 +2,9 @@
 #include "io_adv.h"
 #include "util.h"
 
+/* hex md5 of given string */
+std::string yezzey_md5(const std::string &str);
+
 std::string yezzey_fqrelname_md5(const std::string &nspname,
                                  const std::string &relname);
 
@@ -66,7 +66,17 @@ EXTERNC void emptyYezzeyIndexBlkno(Oid yezzey_index_oid, Oid relation,
 /* fixup virtual index entry for relation's relfilenode. */
 EXTERNC void YezzeyFixupVirtualIndex(Relation rel);
 
+/*
+ * Insert virtual index rows queued by YezzeyVirtualIndexInsert. Called at
+ * the end of statement; xact callback flushes them before commit and
+ * forgets them on abort.
+ */
+EXTERNC void YezzeyVirtualIndexFlush(void);
+
+EXTERNC void YezzeyVirtualIndexXactCallback(XactEvent event, void *arg);
+
 #ifdef __cplusplus
+/* queue row for insertion, see YezzeyVirtualIndexFlush */
 void YezzeyVirtualIndexInsert(Oid yandexoid /*yezzey auxiliary index oid*/,
                               Oid reloid, Oid relfilenodeOid, int64_t blkno,
                               int64_t offset_start, int64_t offset_finish,
@@ -74,6 +84,13 @@ void YezzeyVirtualIndexInsert(Oid yandexoid /*yezzey auxiliary index oid*/,
                               int64_t modcount, XLogRecPtr lsn,
                               const char *x_path /* external path */);
 
+/*
+ * Delete rows of given chunks of segment file, matched by modcount and
+ * external path. Errors out if some of them are not found.
+ */
+void YezzeyVirtualIndexDeleteChunks(Oid yandexoid, Oid relfilenode, int blkno,
+                                    const std::vector<ChunkInfo> &chunks);
+
 std::vector<ChunkInfo>
 YezzeyVirtualGetOrder(Oid yandexoid /*yezzey auxiliary index oid*/, Oid reloid,
                       Oid relfilenode, int blkno);
@@ -11,5 +11,17 @@
 
 EXTERNC void processOffloadedRelations();
 EXTERNC void processPartitionOffload();
+EXTERNC void processCompaction();
+
+/*
+ * Auto-offload background worker, runs on coordinator when yezzey.autooffload
+ * is on. Each yezzey.autooffload_naptime, within offload window, it
+ * offloads relations of yezzey.auto_offload_relations whose expire date
+ * has come. With
+ * yezzey.autooffload_compact, small chunks of offloaded relations are
+ * merged there too.
+ */
+EXTERNC void YezzeyAutoOffloadRegister(void);
+EXTERNC PGDLLEXPORT void yezzey_autooffload_main(Datum main_arg);
 
 #endif /*YEZZEY_WORKER_H*/
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "io_adv.h"
 #include "msgproto.h"
+#include "shm_ring_transport.h"
 #include "unistd.h"
 #include <memory>
 #include <string>
@@ -15,10 +16,25 @@ public:
 
 protected:
   virtual int prepareYproxyConnection();
+  /* open connection to yproxy, returns socket fd or -1 */
+  int connectYproxy();
+  /* close connection, or keep it for next request if it is reusable */
+  void releaseConnection(int fd, bool reusable);
+  /* payload of next request on client_fd_ goes through shared memory */
+  bool useShmRing();
+  int setupShmRing();
   std::shared_ptr<IOadv> adv_{nullptr};
   ssize_t segindx_{0};
 
   int client_fd_{-1};
+  /*
+   * Request on client_fd_ is completed with ReadyForQuery, so with
+   * yezzey.yproxy_keepalive the connection is kept for next request.
+   */
+  bool reusable_{false};
+
+  /* shared memory payload transport of client_fd_, if negotiated */
+  std::unique_ptr<ShmRingTransport> ring_{nullptr};
 };
 
 struct storageChunkMeta {
@@ -33,4 +49,24 @@ extern int commonWriteFull(int client_fd_, const std::vector<char> &msg);
 
 extern int commonReadFull(int client_fd_, void *buf, size_t len);
 
-extern int commonReadRFQResponce(int client_fd_);
\ No newline at end of file
+/*
+ * Wait until fd is readable, checking for interrupts in short slices.
+ * timeout_ms <= 0 waits without limit. Returns 1 when readable, 0 on
+ * timeout and -1 on error.
+ */
+extern int commonWaitReadable(int client_fd_, int timeout_ms);
+
+/*
+ * commonReadFull, bounded by timeout_ms of silence between bytes.
+ * Returns 0 on success, 1 on timeout before first byte (nothing is
+ * consumed, stream is still in sync) and -1 on error, EOF or timeout in
+ * the middle of the data.
+ */
+extern int commonReadFullTimeout(int client_fd_, void *buf, size_t len,
+                                 int timeout_ms);
+
+/*
+ * Read ReadyForQuery message. With timeout_ms > 0 gives up (returning -1)
+ * when yproxy is silent for that long.
+ */
+extern int commonReadRFQResponce(int client_fd_, int timeout_ms = 0);
\ No newline at end of file
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "yproxy_connector.h"
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Multiplexed yproxy connection: several request streams (Cat, Put, ...)
+ * share one socket, every message travels wrapped into a stream frame.
+ * Messages of streams other than the one being read are queued in memory
+ * until their owner asks for them. A stream queueing more than
+ * kMuxStreamQueueLimit bytes is cancelled: yproxy is told to stop it, and
+ * its owner gets failure on next receive and reissues the request from
+ * where it stopped reading.
+ *
+ * Waiting for a stream is bounded by yezzey.read_timeout, after which only
+ * that stream is cancelled. One connection per yproxy socket is kept for
+ * backend lifetime. When it breaks (I/O error, timeout in the middle of a
+ * frame), all streams opened on it fail and owners open new ones.
+ */
+class YProxyMux : YProxyConnector {
+public:
+  explicit YProxyMux(std::shared_ptr<IOadv> adv);
+  ~YProxyMux();
+
+  /* backend-wide connection for adv's yproxy socket */
+  static std::shared_ptr<YProxyMux> get(std::shared_ptr<IOadv> adv);
+
+  /* allocate new stream, connecting if needed; 0 on failure */
+  uint64_t openStream();
+  /* tell yproxy to stop stream, late messages for it are dropped */
+  void closeStream(uint64_t stream);
+
+  bool send(uint64_t stream, const std::vector<char> &msg);
+  /* next message of stream, without length header; false on failure */
+  bool receive(uint64_t stream, std::vector<char> *msg);
+
+private:
+  struct Stream {
+    std::deque<std::vector<char>> queue;
+    /* payload bytes in queue */
+    size_t queued{0};
+    /* cancelled by mux, owner gets failure until it closes stream */
+    bool cancelled{false};
+  };
+
+  /*
+   * Read one frame from connection and queue it to its stream, waiting
+   * for stream's data. false if connection is broken.
+   */
+  bool readFrame(uint64_t waiting);
+  /* stop stream on yproxy side, drop its queue and fail its owner */
+  void cancel(uint64_t stream, Stream &s);
+  /* connection is broken, fail all streams */
+  void fail();
+
+  uint64_t next_stream_{1};
+  std::map<uint64_t, Stream> streams_;
+};
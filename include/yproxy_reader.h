@@ -1,9 +1,13 @@
 #pragma once
 
+#include "chunk_cache.h"
 #include "chunkinfo.h"
 #include "io_adv.h"
+#include "io_throttle.h"
 #include "msgproto.h"
 #include "yproxy_connector.h"
+#include "yproxy_mux.h"
+#include <deque>
 #include <memory>
 #include <vector>
 /* reader using yproxy */
@@ -12,20 +16,66 @@ public:
   using YProxyConnector::prepareYproxyConnection;
   friend class ExternalWriter;
   explicit YProxyReader(std::shared_ptr<IOadv> adv, ssize_t segindx,
-                        std::vector<ChunkInfo> order);
+                        std::vector<ChunkInfo> order, int read_ahead = 0);
   ~YProxyReader();
 
 public:
   virtual bool read(char *buffer, size_t *amount);
+  /* read until buffer is full or EOF */
+  virtual bool readFull(char *buffer, size_t *amount);
+  /* number of syscalls made by last read */
+  int lastReadSyscalls() const { return syscalls_; }
+  /* traffic class external storage reads are throttled as */
+  void setIOClass(YezzeyIOClass cls) { io_class_ = cls; }
 
   virtual bool empty();
 
+  /*
+   * Socket next read waits on, for callers driving several readers from
+   * one poll loop. Opens connection for next chunk if needed. -1 if next
+   * read does not wait on yproxy socket.
+   */
+  int pollFd();
+
+  /* position reader on virtual file offset */
+  virtual bool seek(int64_t offset);
+  /* virtual file offset of next byte to be read */
+  virtual int64_t tell();
+
   virtual bool close();
 
 protected:
   /* prepare connection for chunk reading */
   std::vector<char> ConstructCatRequest(const ChunkInfo &ci, size_t start_off);
   virtual int prepareYproxyConnection(const ChunkInfo &ci, size_t start_off);
+  /* open new connection and issue Cat request, returns socket fd or -1 */
+  int issueCatRequest(const ChunkInfo &ci, size_t start_off);
+
+  /* close connection or multiplexed stream of current chunk */
+  bool closeChunkConnection();
+  /* issue Cat on multiplexed connection instead of own socket */
+  int openMuxStream(const ChunkInfo &ci, size_t start_off);
+  ssize_t readMuxStream(char *buffer, size_t amount);
+
+  /* open connection for current chunk at current_chunk_offset_ */
+  int openCurrentChunk();
+
+  /* issue Cat requests for chunks following the current one */
+  void scheduleReadAhead();
+  /* close all read-ahead connections */
+  void dropReadAhead();
+
+  /* read current chunk from yproxy, reconnecting on failure */
+  ssize_t readStream(char *buffer, size_t amount);
+  /* wait for data with timeout, hedging slow chunk requests */
+  bool waitReadable();
+  void dropHedge();
+  /* sleep before reconnection, exponentially with jitter */
+  void backoff();
+  /* account bytes of current chunk as consumed */
+  void advance(size_t amount);
+  /* stage extent at current position via shared chunk pool */
+  bool fillExtent();
 
 private:
   uint64_t order_ptr_{0};
@@ -34,5 +84,41 @@ private:
   int64_t current_chunk_offset_{0};
 
   int current_retry{0};
+  int syscalls_{0};
   int retry_limit{1};
+
+  /* number of chunks to request ahead of the current one */
+  int read_ahead_{0};
+  /* (chunk index in order_, socket) pairs with Cat request already issued */
+  std::deque<std::pair<uint64_t, int>> prefetched_;
+
+  /* Cat stream, when yezzey.yproxy_multiplex is on */
+  std::shared_ptr<YProxyMux> mux_{nullptr};
+  uint64_t mux_stream_{0};
+  /* CopyData message being consumed */
+  std::vector<char> mux_data_;
+  size_t mux_pos_{0};
+
+  /* client_fd_ is local disk cache file, not yproxy connection */
+  bool reading_cache_{false};
+
+  YezzeyIOClass io_class_{YezzeyIOClass::Foreground};
+
+  /* first byte of current request not received yet */
+  bool awaiting_first_byte_{false};
+  /* current request latency is representative for hedging threshold */
+  bool record_latency_{false};
+  double request_started_ms_{0};
+  /* duplicate of current request, alive only within waitReadable */
+  int hedge_fd_{-1};
+  double hedge_started_ms_{0};
+
+  /* stores current chunk in local disk cache while it is streamed */
+  std::unique_ptr<ChunkCacheFiller> cache_filler_{nullptr};
+
+  /* extent obtained via shared chunk pool, not yet returned to caller */
+  std::vector<char> extent_;
+  size_t extent_pos_{0};
+  size_t extent_len_{0};
+  int64_t extent_virt_off_{0};
 };
@@ -2,6 +2,7 @@
 
 #include "msgproto.h"
 #include "yproxy_connector.h"
+#include "yproxy_mux.h"
 // Write into external storage using yproxy
 class YProxyWriter : YProxyConnector {
 public:
@@ -12,6 +13,17 @@ public:
 
   virtual bool write(const char *buffer, size_t *amount);
 
+  /*
+   * For callers driving several writers from one poll loop: send as much
+   * of CopyData frame of amount bytes of buffer as socket accepts without
+   * blocking. *sent counts frame bytes sent so far, frame is complete when
+   * it reaches COPY_DATA_HEADER_SIZE + amount.
+   */
+  bool writeNonBlocking(const char *buffer, size_t amount, size_t *sent);
+
+  /* socket to wait on before writeNonBlocking, -1 if not supported */
+  int pollFd();
+
   virtual bool close();
 
 protected:
@@ -25,6 +37,13 @@ private:
   std::string createXPath();
 
   int readPutCompleteResponce(int client_fd_);
+  int parsePutComplete(const std::vector<char> &data);
+
+  bool closeMuxStream();
+
+  /* Put stream, when yezzey.yproxy_multiplex is on */
+  std::shared_ptr<YProxyMux> mux_{nullptr};
+  uint64_t mux_stream_{0};
 
   ssize_t modcount_;
   XLogRecPtr insertion_rec_ptr_;
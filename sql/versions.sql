@@ -19,5 +19,7 @@ ALTER EXTENSION yezzey UPDATE TO '1.8.7';
 
 ALTER EXTENSION yezzey UPDATE TO '1.8.8';
 
+ALTER EXTENSION yezzey UPDATE TO '1.8.9';
+
 DROP EXTENSION yezzey;
 CHECKPOINT;
@@ -0,0 +1,45 @@
+-- Auto-offload worker offloads relations whose expire date has passed.
+-- Test cluster runs with yezzey.autooffload on, worker serves database
+-- postgres (default yezzey.autooffload_database).
+\c postgres
+CREATE EXTENSION yezzey;
+
+SHOW yezzey.autooffload;
+
+CREATE TABLE autooffload_regaoty(i INT) WITH (appendonly=true) DISTRIBUTED BY (i);
+INSERT INTO autooffload_regaoty SELECT * FROM generate_series(1, 10000);
+CREATE TABLE autooffload_fresh_regaoty(i INT) WITH (appendonly=true) DISTRIBUTED BY (i);
+INSERT INTO autooffload_fresh_regaoty SELECT * FROM generate_series(1, 10000);
+
+INSERT INTO yezzey.auto_offload_relations
+VALUES ('autooffload_regaoty'::regclass, current_date - 1),
+       ('autooffload_fresh_regaoty'::regclass, current_date + 1);
+
+-- Wait for worker round, at most two minutes.
+DO $$
+BEGIN
+    FOR i IN 1..1200 LOOP
+        PERFORM 1 FROM yezzey.offload_metadata
+        WHERE reloid = 'autooffload_regaoty'::regclass AND relpolicy = 1;
+        IF FOUND THEN
+            RETURN;
+        END IF;
+        PERFORM pg_sleep(0.1);
+    END LOOP;
+    RAISE NOTICE 'relation is not auto-offloaded';
+END;
+$$;
+
+-- Expired relation is offloaded, the other one is left alone.
+SELECT c.relname, count(m.reloid) AS offloaded_rows
+FROM pg_class c LEFT JOIN yezzey.offload_metadata m
+ON m.reloid = c.oid AND m.relpolicy = 1
+WHERE c.relname IN ('autooffload_regaoty', 'autooffload_fresh_regaoty')
+GROUP BY c.relname ORDER BY c.relname;
+
+SELECT count(1) FROM autooffload_regaoty;
+
+DROP TABLE autooffload_regaoty;
+DROP TABLE autooffload_fresh_regaoty;
+
+DROP EXTENSION yezzey;
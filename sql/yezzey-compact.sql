@@ -0,0 +1,55 @@
+-- Compaction merges small external storage chunks of offloaded relation
+-- into one object per segment file and replaces their virtual index rows.
+CREATE EXTENSION yezzey VERSION '1.0';
+ALTER EXTENSION yezzey UPDATE TO '1.8.9';
+
+SET client_min_messages TO WARNING;
+
+CREATE TABLE compact_regaoty(i INT) WITH (appendonly=true) DISTRIBUTED BY (i);
+INSERT INTO compact_regaoty SELECT * FROM generate_series(1, 1000);
+SELECT * FROM yezzey_define_offload_policy('compact_regaoty');
+
+-- Every insert adds a chunk to each segment file.
+INSERT INTO compact_regaoty SELECT * FROM generate_series(1001, 2000);
+INSERT INTO compact_regaoty SELECT * FROM generate_series(2001, 3000);
+INSERT INTO compact_regaoty SELECT * FROM generate_series(3001, 4000);
+
+SELECT max(chunks) AS chunks_per_file, min(first_offset) AS first_offset
+FROM (SELECT count(1) AS chunks, min(offset_start) AS first_offset
+      FROM gp_dist_random('yezzey.yezzey_virtual_index')
+      WHERE relation = 'compact_regaoty'::regclass AND offset_finish > offset_start
+      GROUP BY gp_segment_id, filenode, blkno) f;
+SELECT count(1), sum(i) FROM compact_regaoty;
+
+SELECT * FROM yezzey_compact_relation('compact_regaoty');
+
+-- One merged chunk per segment file, still covering it from the start.
+SELECT max(chunks) AS chunks_per_file, min(first_offset) AS first_offset
+FROM (SELECT count(1) AS chunks, min(offset_start) AS first_offset
+      FROM gp_dist_random('yezzey.yezzey_virtual_index')
+      WHERE relation = 'compact_regaoty'::regclass AND offset_finish > offset_start
+      GROUP BY gp_segment_id, filenode, blkno) f;
+SELECT count(1), sum(i) FROM compact_regaoty;
+
+-- Relation is written and read after compaction as before.
+INSERT INTO compact_regaoty SELECT * FROM generate_series(4001, 5000);
+SELECT max(chunks) AS chunks_per_file, min(first_offset) AS first_offset
+FROM (SELECT count(1) AS chunks, min(offset_start) AS first_offset
+      FROM gp_dist_random('yezzey.yezzey_virtual_index')
+      WHERE relation = 'compact_regaoty'::regclass AND offset_finish > offset_start
+      GROUP BY gp_segment_id, filenode, blkno) f;
+SELECT count(1), sum(i) FROM compact_regaoty;
+
+-- Merged chunk is small still, later chunks are merged into it.
+SELECT * FROM yezzey_compact_relation('compact_regaoty');
+SELECT max(chunks) AS chunks_per_file, min(first_offset) AS first_offset
+FROM (SELECT count(1) AS chunks, min(offset_start) AS first_offset
+      FROM gp_dist_random('yezzey.yezzey_virtual_index')
+      WHERE relation = 'compact_regaoty'::regclass AND offset_finish > offset_start
+      GROUP BY gp_segment_id, filenode, blkno) f;
+SELECT count(1), sum(i) FROM compact_regaoty;
+
+DROP TABLE compact_regaoty;
+
+DROP EXTENSION yezzey;
+CHECKPOINT;
@@ -0,0 +1,48 @@
+-- Chunks read by queries are kept in segment-local disk cache, later reads
+-- of them are served from there.
+CREATE EXTENSION yezzey VERSION '1.0';
+ALTER EXTENSION yezzey UPDATE TO '1.8.9';
+
+SET client_min_messages TO WARNING;
+SET yezzey.disk_cache_size = 64;
+SET yezzey.disk_cache_path = 'yezzey_cache_regress';
+
+CREATE TABLE disk_cache_regaoty(i INT) WITH (appendonly=true) DISTRIBUTED BY (i);
+INSERT INTO disk_cache_regaoty SELECT * FROM generate_series(1, 10000);
+SELECT * FROM yezzey_define_offload_policy('disk_cache_regaoty');
+
+CREATE FUNCTION disk_cache_files(i_dir TEXT)
+RETURNS TABLE (name TEXT)
+AS $$
+BEGIN
+    RETURN QUERY SELECT pg_ls_dir(i_dir);
+END;
+$$
+EXECUTE ON ALL SEGMENTS
+LANGUAGE plpgsql;
+
+-- First read fills the cache.
+SELECT count(1), sum(i) FROM disk_cache_regaoty;
+SELECT count(1) AS cached_files FROM disk_cache_files('yezzey_cache_regress') \gset
+SELECT :cached_files > 0 AS cached;
+
+-- Second read is served from the cache and returns the same rows.
+SELECT count(1), sum(i) FROM disk_cache_regaoty;
+
+-- Chunks of later inserts are cached on read too.
+INSERT INTO disk_cache_regaoty SELECT * FROM generate_series(10001, 20000);
+SELECT count(1), sum(i) FROM disk_cache_regaoty;
+SELECT count(1) > :cached_files AS cached
+FROM disk_cache_files('yezzey_cache_regress');
+SELECT count(1), sum(i) FROM disk_cache_regaoty;
+
+-- Cache is bypassed once disabled.
+RESET yezzey.disk_cache_size;
+SELECT count(1), sum(i) FROM disk_cache_regaoty;
+
+DROP TABLE disk_cache_regaoty;
+DROP FUNCTION disk_cache_files(TEXT);
+RESET yezzey.disk_cache_path;
+
+DROP EXTENSION yezzey;
+CHECKPOINT;
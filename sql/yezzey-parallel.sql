@@ -0,0 +1,35 @@
+-- Segment files of a relation, here columns of AOCS relation, are uploaded
+-- and downloaded several at once.
+CREATE EXTENSION yezzey VERSION '1.0';
+ALTER EXTENSION yezzey UPDATE TO '1.8.9';
+
+SET client_min_messages TO WARNING;
+
+CREATE TABLE parallel_regaocs(a INT, b INT, c TEXT, d BIGINT)
+WITH (appendonly=true, orientation=column) DISTRIBUTED BY (a);
+INSERT INTO parallel_regaocs
+SELECT i, i % 7, 'row' || i % 13, i * 2 FROM generate_series(1, 10000) i;
+
+SET yezzey.offload_parallel = 4;
+SELECT * FROM yezzey_define_offload_policy('parallel_regaocs');
+RESET yezzey.offload_parallel;
+
+-- Every column reached external storage on every segment.
+SELECT min(files) AS min_files, max(files) AS max_files
+FROM (SELECT count(DISTINCT blkno) AS files
+      FROM gp_dist_random('yezzey.yezzey_virtual_index')
+      WHERE relation = 'parallel_regaocs'::regclass AND offset_finish > offset_start
+      GROUP BY gp_segment_id) s;
+SELECT count(1), sum(a), sum(b), count(DISTINCT c), sum(d) FROM parallel_regaocs;
+
+SET yezzey.load_parallel = 4;
+SELECT yezzey_load_relation('parallel_regaocs');
+RESET yezzey.load_parallel;
+
+SELECT reltablespace FROM pg_class where oid = 'parallel_regaocs'::regclass::oid;
+SELECT count(1), sum(a), sum(b), count(DISTINCT c), sum(d) FROM parallel_regaocs;
+
+DROP TABLE parallel_regaocs;
+
+DROP EXTENSION yezzey;
+CHECKPOINT;
@@ -0,0 +1,50 @@
+-- Chunks of a segment file cover it without gaps. Reading at an offset no
+-- chunk covers is reported as data corruption, instead of returning bytes
+-- of the next chunk as if they were requested.
+CREATE EXTENSION yezzey VERSION '1.0';
+ALTER EXTENSION yezzey UPDATE TO '1.8.9';
+
+SET client_min_messages TO WARNING;
+
+CREATE TABLE read_hole_regaoty(i INT) WITH (appendonly=true) DISTRIBUTED BY (i);
+INSERT INTO read_hole_regaoty SELECT * FROM generate_series(1, 1000);
+SELECT * FROM yezzey_define_offload_policy('read_hole_regaoty');
+INSERT INTO read_hole_regaoty SELECT * FROM generate_series(1001, 2000);
+SELECT count(1), sum(i) FROM read_hole_regaoty;
+
+-- Lose virtual index rows of first chunks of segment files.
+CREATE FUNCTION read_hole_drop_first_chunks(i_reloid OID)
+RETURNS TABLE (dropped BIGINT)
+AS $$
+DECLARE
+    v_dropped BIGINT;
+BEGIN
+    DELETE FROM yezzey.yezzey_virtual_index
+    WHERE relation = i_reloid AND offset_start = 0 AND offset_finish > 0;
+    GET DIAGNOSTICS v_dropped = ROW_COUNT;
+    RETURN QUERY SELECT v_dropped;
+END;
+$$
+EXECUTE ON ALL SEGMENTS
+LANGUAGE plpgsql;
+
+SELECT sum(dropped) > 0 AS dropped
+FROM read_hole_drop_first_chunks('read_hole_regaoty'::regclass);
+
+-- Scan starts at offset 0, which is now in a hole.
+SET client_min_messages TO NOTICE;
+DO $$
+BEGIN
+    PERFORM count(1) FROM read_hole_regaoty;
+    RAISE NOTICE 'unexpected: no error raised';
+EXCEPTION WHEN data_corrupted THEN
+    RAISE NOTICE 'caught data_corrupted';
+END;
+$$;
+SET client_min_messages TO WARNING;
+
+DROP TABLE read_hole_regaoty;
+DROP FUNCTION read_hole_drop_first_chunks(OID);
+
+DROP EXTENSION yezzey;
+CHECKPOINT;
@@ -0,0 +1,51 @@
+-- Virtual index rows of inserts into offloaded relation are queued and
+-- flushed at statement end, before reads, at subtransaction end and at
+-- commit.
+CREATE EXTENSION yezzey VERSION '1.0';
+ALTER EXTENSION yezzey UPDATE TO '1.8.9';
+
+SET client_min_messages TO WARNING;
+
+CREATE TABLE vi_batch_regaoty(i INT) WITH (appendonly=true) DISTRIBUTED BY (i);
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(1, 1000);
+SELECT * FROM yezzey_define_offload_policy('vi_batch_regaoty');
+
+-- Inserts are read back within their transaction.
+BEGIN;
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(1001, 2000);
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(2001, 3000);
+SELECT count(1), sum(i) FROM vi_batch_regaoty;
+COMMIT;
+SELECT count(1), sum(i) FROM vi_batch_regaoty;
+
+-- Rows of rolled back subtransaction are gone, others are kept.
+BEGIN;
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(3001, 4000);
+SAVEPOINT s1;
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(4001, 5000);
+ROLLBACK TO SAVEPOINT s1;
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(5001, 6000);
+SAVEPOINT s2;
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(6001, 7000);
+RELEASE SAVEPOINT s2;
+SELECT count(1), sum(i) FROM vi_batch_regaoty;
+COMMIT;
+SELECT count(1), sum(i) FROM vi_batch_regaoty;
+
+-- Inserts that are not read back are flushed at commit.
+BEGIN;
+INSERT INTO vi_batch_regaoty SELECT * FROM generate_series(7001, 8000);
+COMMIT;
+SELECT count(1), sum(i) FROM vi_batch_regaoty;
+
+-- One visible chunk per committed insert, and the offloaded one.
+SELECT max(chunks) AS chunks_per_file
+FROM (SELECT count(1) AS chunks
+      FROM gp_dist_random('yezzey.yezzey_virtual_index')
+      WHERE relation = 'vi_batch_regaoty'::regclass AND offset_finish > offset_start
+      GROUP BY gp_segment_id, filenode, blkno) f;
+
+DROP TABLE vi_batch_regaoty;
+
+DROP EXTENSION yezzey;
+CHECKPOINT;
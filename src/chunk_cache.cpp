@@ -0,0 +1,239 @@
+/*
+ *
+ * file: src/chunk_cache.cpp
+ */
+
+#include "chunk_cache.h"
+#include "gucs.h"
+#include "url.h"
+
+#include <algorithm>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <vector>
+
+/* other backends fill the cache too, size estimate is refreshed that often */
+const time_t kCacheRescanSec = 10;
+
+/* cache size as of last scan by this backend, plus its own additions */
+static int64_t cache_size_estimate = -1;
+static time_t cache_size_scanned = 0;
+
+bool ChunkDiskCache::enabled(const ChunkInfo &ci) {
+  return yezzey_disk_cache_size > 0 &&
+         ci.size <= (uint64_t)yezzey_disk_cache_size * 1024 * 1024;
+}
+
+std::string ChunkDiskCache::directory() {
+  return std::string(yezzey_disk_cache_path);
+}
+
+/* cache key: external path and virtual byte range of chunk */
+std::string ChunkDiskCache::path(const ChunkInfo &ci) {
+  return directory() + "/" + yezzey_md5(ci.x_path()) + "_" +
+         std::to_string(ci.start_off) + "_" + std::to_string(ci.size);
+}
+
+bool ChunkDiskCache::contains(const ChunkInfo &ci) {
+  struct stat st;
+  return enabled(ci) && stat(path(ci).c_str(), &st) == 0 &&
+         (uint64_t)st.st_size == ci.size;
+}
+
+int ChunkDiskCache::open(const ChunkInfo &ci, size_t start_off) {
+  if (!enabled(ci)) {
+    return -1;
+  }
+
+  const auto p = path(ci);
+  const auto fd = ::open(p.c_str(), O_RDONLY | PG_BINARY);
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != ci.size) {
+    /* should not happen, files are published by rename */
+    elog(WARNING, "yezzey: dropping corrupted cached chunk %s", p.c_str());
+    ::close(fd);
+    (void)unlink(p.c_str());
+    return -1;
+  }
+
+  if (lseek(fd, start_off, SEEK_SET) != (off_t)start_off) {
+    ::close(fd);
+    return -1;
+  }
+
+  /* bump recency for LRU eviction */
+  (void)futimens(fd, NULL);
+
+  elog(yezzey_ao_log_level, "yezzey: reading chunk %s from cache %s",
+       ci.x_path().c_str(), p.c_str());
+  return fd;
+}
+
+void ChunkDiskCache::evict(const std::string &x_path) {
+  if (yezzey_disk_cache_size <= 0) {
+    return;
+  }
+
+  const auto prefix = yezzey_md5(x_path) + "_";
+  const auto dir = directory();
+  auto d = opendir(dir.c_str());
+  if (d == NULL) {
+    return;
+  }
+
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    if (strncmp(de->d_name, prefix.c_str(), prefix.size()) == 0) {
+      (void)unlink((dir + "/" + de->d_name).c_str());
+    }
+  }
+  closedir(d);
+}
+
+void ChunkDiskCache::added(uint64_t size) {
+  const uint64_t limit = (uint64_t)yezzey_disk_cache_size * 1024 * 1024;
+
+  if (cache_size_estimate >= 0 &&
+      time(NULL) - cache_size_scanned < kCacheRescanSec) {
+    cache_size_estimate += size;
+    if ((uint64_t)cache_size_estimate <= limit) {
+      return;
+    }
+  }
+  enforceLimit();
+}
+
+void ChunkDiskCache::enforceLimit() {
+  struct entry {
+    std::string path;
+    time_t mtime;
+    uint64_t size;
+  };
+  std::vector<entry> entries;
+  uint64_t total = 0;
+  const uint64_t limit = (uint64_t)yezzey_disk_cache_size * 1024 * 1024;
+
+  const auto dir = directory();
+  auto d = opendir(dir.c_str());
+  if (d == NULL) {
+    return;
+  }
+
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    if (de->d_name[0] == '.') {
+      continue;
+    }
+    struct stat st;
+    auto p = dir + "/" + de->d_name;
+    if (stat(p.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    entries.push_back({p, st.st_mtime, (uint64_t)st.st_size});
+    total += st.st_size;
+  }
+  closedir(d);
+
+  cache_size_scanned = time(NULL);
+  cache_size_estimate = total;
+  if (total <= limit) {
+    return;
+  }
+
+  /* leftovers of crashed fillers are old, so they go first too */
+  std::sort(entries.begin(), entries.end(),
+            [](const entry &lhs, const entry &rhs) {
+              return lhs.mtime < rhs.mtime;
+            });
+
+  for (const auto &e : entries) {
+    if (total <= limit) {
+      break;
+    }
+    if (unlink(e.path.c_str()) == 0) {
+      elog(yezzey_ao_log_level, "yezzey: evicted cached chunk %s",
+           e.path.c_str());
+      total -= e.size;
+    }
+  }
+  cache_size_estimate = total;
+}
+
+ChunkCacheFiller::ChunkCacheFiller(const ChunkInfo &ci)
+    : path_(ChunkDiskCache::path(ci)),
+      tmp_path_(path_ + ".tmp." + std::to_string(MyProcPid)),
+      expected_(ci.size), written_(0) {
+  const auto dir = ChunkDiskCache::directory();
+  if (mkdir(dir.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+    elog(WARNING, "yezzey: could not create cache directory %s: %m",
+         dir.c_str());
+    return;
+  }
+
+  fd_ = ::open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+               S_IRUSR | S_IWUSR);
+  if (fd_ == -1) {
+    elog(WARNING, "yezzey: could not create cache file %s: %m",
+         tmp_path_.c_str());
+  }
+}
+
+ChunkCacheFiller::~ChunkCacheFiller() { abort(); }
+
+void ChunkCacheFiller::abort() {
+  if (fd_ == -1) {
+    return;
+  }
+  ::close(fd_);
+  fd_ = -1;
+  (void)unlink(tmp_path_.c_str());
+}
+
+void ChunkCacheFiller::append(const char *buffer, size_t amount) {
+  if (fd_ == -1) {
+    return;
+  }
+
+  size_t done = 0;
+  while (done < amount) {
+    const auto rc = ::write(fd_, buffer + done, amount - done);
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      /* most likely out of disk space, give up caching this chunk */
+      elog(yezzey_ao_log_level, "yezzey: could not write cache file %s: %m",
+           tmp_path_.c_str());
+      abort();
+      return;
+    }
+    done += rc;
+  }
+  written_ += amount;
+}
+
+void ChunkCacheFiller::complete() {
+  if (fd_ == -1) {
+    return;
+  }
+  if (written_ != expected_) {
+    abort();
+    return;
+  }
+
+  ::close(fd_);
+  fd_ = -1;
+
+  if (rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+    /* evicted under our feet, or concurrent filler won */
+    (void)unlink(tmp_path_.c_str());
+    return;
+  }
+
+  ChunkDiskCache::added(written_);
+}
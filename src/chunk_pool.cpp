@@ -0,0 +1,365 @@
+/*
+ *
+ * file: src/chunk_pool.cpp
+ */
+
+#include "chunk_pool.h"
+#include "gucs.h"
+
+extern "C" {
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#if PG_VERSION_NUM >= 100000
+#include "pgstat.h"
+#include "storage/condition_variable.h"
+#endif
+}
+
+#define CHUNK_POOL_TRANCHE "yezzey_chunk_pool"
+#define CHUNK_POOL_MAX_USAGE 5
+
+#if PG_VERSION_NUM < 100000
+/* without condition variables, waiters recheck loading slot that often */
+const long kChunkPoolWaitUs = 1000;
+#endif
+
+typedef enum ChunkPoolSlotState {
+  ChunkPoolSlotEmpty = 0,
+  ChunkPoolSlotLoading,
+  ChunkPoolSlotValid,
+} ChunkPoolSlotState;
+
+/* hash key, zero padded, as it is hashed as a whole */
+typedef struct ChunkPoolTag {
+  char x_path[MAXPGPATH];
+  uint64 offset;
+  uint32 len;
+} ChunkPoolTag;
+
+typedef struct ChunkPoolEntry {
+  ChunkPoolTag tag;
+  int slot;
+} ChunkPoolEntry;
+
+typedef struct ChunkPoolSlot {
+  ChunkPoolSlotState state;
+  /* clock sweep usage count, bumped under shared lock */
+  pg_atomic_uint32 usage;
+  /* backends copying slot data out, pinned only under mapping lock */
+  pg_atomic_uint32 pins;
+  /* bumped on each claim, so waiters do not mistake a reused slot */
+  uint64 generation;
+  ChunkPoolTag tag;
+} ChunkPoolSlot;
+
+typedef struct ChunkPoolCtl {
+  /* protects hash table, slots keys and states, never held across I/O */
+  LWLock *lock;
+#if PG_VERSION_NUM >= 100000
+  /* broadcast when loading slot is published or abandoned */
+  ConditionVariable cv;
+#endif
+  int nslots;
+  int clock_hand;
+  ChunkPoolSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} ChunkPoolCtl;
+
+static ChunkPoolCtl *pool = NULL;
+static HTAB *pool_hash = NULL;
+static char *pool_data = NULL;
+
+/* slot this backend is loading, reset if it errors out or exits */
+static int claimed_slot = -1;
+static bool exit_callback_registered = false;
+
+static int ChunkPoolSlots(void) {
+  return (int)((int64)yezzey_chunk_pool_size * 1024 * 1024 /
+               YEZZEY_CHUNK_POOL_EXTENT);
+}
+
+static Size ChunkPoolCtlSize(int nslots) {
+  return add_size(offsetof(ChunkPoolCtl, slots),
+                  mul_size(nslots, sizeof(ChunkPoolSlot)));
+}
+
+static Size ChunkPoolDataSize(int nslots) {
+  return mul_size(nslots, YEZZEY_CHUNK_POOL_EXTENT);
+}
+
+void YezzeyChunkPoolShmemRequest(void) {
+  const int nslots = ChunkPoolSlots();
+  if (nslots == 0) {
+    return;
+  }
+
+  RequestAddinShmemSpace(
+      add_size(add_size(ChunkPoolCtlSize(nslots), ChunkPoolDataSize(nslots)),
+               hash_estimate_size(nslots, sizeof(ChunkPoolEntry))));
+#if PG_VERSION_NUM >= 90600
+  RequestNamedLWLockTranche(CHUNK_POOL_TRANCHE, 1);
+#else
+  RequestAddinLWLocks(1);
+#endif
+}
+
+void YezzeyChunkPoolShmemInit(void) {
+  const int nslots = ChunkPoolSlots();
+  bool found;
+  bool found_data;
+  HASHCTL info;
+
+  if (nslots == 0) {
+    return;
+  }
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  pool = (ChunkPoolCtl *)ShmemInitStruct("yezzey chunk pool",
+                                         ChunkPoolCtlSize(nslots), &found);
+  pool_data = (char *)ShmemInitStruct("yezzey chunk pool data",
+                                      ChunkPoolDataSize(nslots), &found_data);
+
+  memset(&info, 0, sizeof(info));
+  info.keysize = sizeof(ChunkPoolTag);
+  info.entrysize = sizeof(ChunkPoolEntry);
+#if PG_VERSION_NUM >= 90500
+  pool_hash = ShmemInitHash("yezzey chunk pool hash", nslots, nslots, &info,
+                            HASH_ELEM | HASH_BLOBS);
+#else
+  info.hash = tag_hash;
+  pool_hash = ShmemInitHash("yezzey chunk pool hash", nslots, nslots, &info,
+                            HASH_ELEM | HASH_FUNCTION);
+#endif
+
+  if (!found) {
+#if PG_VERSION_NUM >= 90600
+    pool->lock = &(GetNamedLWLockTranche(CHUNK_POOL_TRANCHE))->lock;
+#else
+    pool->lock = LWLockAssign();
+#endif
+#if PG_VERSION_NUM >= 100000
+    ConditionVariableInit(&pool->cv);
+#endif
+    pool->nslots = nslots;
+    pool->clock_hand = 0;
+
+    for (int i = 0; i < nslots; ++i) {
+      auto s = &pool->slots[i];
+      memset(s, 0, sizeof(ChunkPoolSlot));
+      s->state = ChunkPoolSlotEmpty;
+      pg_atomic_init_u32(&s->usage, 0);
+      pg_atomic_init_u32(&s->pins, 0);
+    }
+  }
+
+  LWLockRelease(AddinShmemInitLock);
+}
+
+bool ChunkPool::enabled() { return pool != NULL; }
+
+static void ChunkPoolInitTag(ChunkPoolTag *tag, const std::string &x_path,
+                             uint64_t offset, size_t len) {
+  memset(tag, 0, sizeof(ChunkPoolTag));
+  strlcpy(tag->x_path, x_path.c_str(), MAXPGPATH);
+  tag->offset = offset;
+  tag->len = len;
+}
+
+/* caller holds mapping lock */
+static int ChunkPoolLookup(const ChunkPoolTag *tag) {
+  const auto e =
+      (ChunkPoolEntry *)hash_search(pool_hash, tag, HASH_FIND, NULL);
+  return e == NULL ? -1 : e->slot;
+}
+
+/*
+ * Clock sweep over slots, caller holds mapping lock exclusively. Loading
+ * slots are skipped, their loaders reset them even on error, so are pinned
+ * ones. Pins are only taken under mapping lock, so unpinned slot stays so
+ * until we release it. Returns slot index, or -1 if every slot is busy.
+ */
+static int ChunkPoolVictim(void) {
+  for (int n = 0; n < pool->nslots * (CHUNK_POOL_MAX_USAGE + 1); ++n) {
+    const int i = pool->clock_hand;
+    const auto s = &pool->slots[i];
+    pool->clock_hand = (pool->clock_hand + 1) % pool->nslots;
+
+    if (s->state == ChunkPoolSlotLoading ||
+        pg_atomic_read_u32(&s->pins) > 0) {
+      continue;
+    }
+    if (s->state == ChunkPoolSlotValid &&
+        pg_atomic_read_u32(&s->usage) > 0) {
+      pg_atomic_fetch_sub_u32(&s->usage, 1);
+      continue;
+    }
+    return i;
+  }
+  return -1;
+}
+
+/* caller holds mapping lock exclusively */
+static void ChunkPoolReset(int slot) {
+  const auto s = &pool->slots[slot];
+  if (s->state != ChunkPoolSlotEmpty) {
+    (void)hash_search(pool_hash, &s->tag, HASH_REMOVE, NULL);
+  }
+  s->state = ChunkPoolSlotEmpty;
+}
+
+static void ChunkPoolWakeup(void) {
+#if PG_VERSION_NUM >= 100000
+  ConditionVariableBroadcast(&pool->cv);
+#endif
+}
+
+/*
+ * Sleep until slot is not loading given generation any more. Interruptible,
+ * no lock is held while sleeping.
+ */
+static void ChunkPoolWaitLoaded(int slot, uint64 generation) {
+  const auto s = &pool->slots[slot];
+
+#if PG_VERSION_NUM >= 100000
+  ConditionVariablePrepareToSleep(&pool->cv);
+#endif
+  while (true) {
+    LWLockAcquire(pool->lock, LW_SHARED);
+    const bool loading =
+        s->state == ChunkPoolSlotLoading && s->generation == generation;
+    LWLockRelease(pool->lock);
+    if (!loading) {
+      break;
+    }
+#if PG_VERSION_NUM >= 100000
+    ConditionVariableSleep(&pool->cv, PG_WAIT_EXTENSION);
+#else
+    CHECK_FOR_INTERRUPTS();
+    pg_usleep(kChunkPoolWaitUs);
+#endif
+  }
+#if PG_VERSION_NUM >= 100000
+  ConditionVariableCancelSleep();
+#endif
+}
+
+/* backend exits in the middle of loading, e.g. on FATAL */
+static void ChunkPoolShmemExit(int code, Datum arg) {
+  if (claimed_slot != -1) {
+    ChunkPool::abandon(claimed_slot);
+  }
+}
+
+ChunkPool::Result ChunkPool::acquire(const std::string &x_path,
+                                     uint64_t offset, size_t len,
+                                     char *buffer, int *slot) {
+  if (pool == NULL || len > YEZZEY_CHUNK_POOL_EXTENT ||
+      x_path.size() >= MAXPGPATH) {
+    return Result::Bypass;
+  }
+
+  if (!exit_callback_registered) {
+    before_shmem_exit(ChunkPoolShmemExit, 0);
+    exit_callback_registered = true;
+  }
+
+  ChunkPoolTag tag;
+  ChunkPoolInitTag(&tag, x_path, offset, len);
+
+  while (true) {
+    LWLockAcquire(pool->lock, LW_SHARED);
+    auto i = ChunkPoolLookup(&tag);
+    if (i != -1 && pool->slots[i].state == ChunkPoolSlotValid) {
+      const auto s = &pool->slots[i];
+      auto usage = pg_atomic_read_u32(&s->usage);
+      while (usage < CHUNK_POOL_MAX_USAGE &&
+             !pg_atomic_compare_exchange_u32(&s->usage, &usage, usage + 1)) {
+      }
+      /*
+       * Pinned slot is never chosen as victim, so data is stable while we
+       * copy it without mapping lock. Nothing between pin and unpin can
+       * error out.
+       */
+      pg_atomic_fetch_add_u32(&s->pins, 1);
+      LWLockRelease(pool->lock);
+
+      memcpy(buffer, pool_data + (Size)i * YEZZEY_CHUNK_POOL_EXTENT, len);
+      pg_atomic_fetch_sub_u32(&s->pins, 1);
+      *slot = i;
+      return Result::Hit;
+    }
+    LWLockRelease(pool->lock);
+
+    LWLockAcquire(pool->lock, LW_EXCLUSIVE);
+    i = ChunkPoolLookup(&tag);
+    if (i != -1) {
+      const auto s = &pool->slots[i];
+      if (s->state == ChunkPoolSlotValid) {
+        /* published while we were relocking */
+        LWLockRelease(pool->lock);
+        continue;
+      }
+
+      /* single-flight: sleep until loader is done, then look again */
+      const auto generation = s->generation;
+      LWLockRelease(pool->lock);
+      elog(yezzey_ao_log_level,
+           "yezzey: waiting for concurrent load of %s at offset %lu",
+           x_path.c_str(), offset);
+      ChunkPoolWaitLoaded(i, generation);
+      continue;
+    }
+
+    i = ChunkPoolVictim();
+    if (i == -1) {
+      /* every slot is busy */
+      LWLockRelease(pool->lock);
+      return Result::Bypass;
+    }
+
+    ChunkPoolReset(i);
+    const auto s = &pool->slots[i];
+    auto e = (ChunkPoolEntry *)hash_search(pool_hash, &tag, HASH_ENTER_NULL,
+                                           NULL);
+    if (e == NULL) {
+      LWLockRelease(pool->lock);
+      return Result::Bypass;
+    }
+    e->slot = i;
+    s->state = ChunkPoolSlotLoading;
+    pg_atomic_write_u32(&s->usage, 1);
+    ++s->generation;
+    s->tag = tag;
+    claimed_slot = i;
+    LWLockRelease(pool->lock);
+
+    *slot = i;
+    return Result::Claimed;
+  }
+}
+
+void ChunkPool::publish(int slot, const char *buffer, size_t len) {
+  const auto s = &pool->slots[slot];
+
+  /* nobody reads loading slot, so copy without mapping lock */
+  memcpy(pool_data + (Size)slot * YEZZEY_CHUNK_POOL_EXTENT, buffer, len);
+
+  LWLockAcquire(pool->lock, LW_EXCLUSIVE);
+  s->state = ChunkPoolSlotValid;
+  LWLockRelease(pool->lock);
+  claimed_slot = -1;
+
+  ChunkPoolWakeup();
+}
+
+void ChunkPool::abandon(int slot) {
+  LWLockAcquire(pool->lock, LW_EXCLUSIVE);
+  ChunkPoolReset(slot);
+  LWLockRelease(pool->lock);
+  claimed_slot = -1;
+
+  ChunkPoolWakeup();
+}
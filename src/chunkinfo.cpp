@@ -0,0 +1,49 @@
+/*
+ *
+ * file: src/chunkinfo.cpp
+ */
+
+#include "chunkinfo.h"
+#include "util.h"
+
+#include <cstring>
+
+uint32_t ChunkPaths::intern(const char *x_path, size_t len, int64_t modcount,
+                            XLogRecPtr lsn) {
+  const auto suffix = make_yezzey_url("", modcount, lsn);
+  if (len <= suffix.size() ||
+      memcmp(x_path + len - suffix.size(), suffix.data(), suffix.size()) !=
+          0) {
+    whole_.emplace_back(x_path, len);
+    return kWholePath | (uint32_t)(whole_.size() - 1);
+  }
+
+  const size_t prefix_len = len - suffix.size();
+  /* chunks of segment file mostly share the prefix of previous one */
+  if (!prefixes_.empty()) {
+    const auto &last = prefixes_[last_prefix_];
+    if (last.size() == prefix_len &&
+        memcmp(last.data(), x_path, prefix_len) == 0) {
+      return last_prefix_;
+    }
+  }
+
+  std::string prefix(x_path, prefix_len);
+  const auto it = prefix_ids_.find(prefix);
+  if (it != prefix_ids_.end()) {
+    last_prefix_ = it->second;
+    return last_prefix_;
+  }
+  last_prefix_ = (uint32_t)prefixes_.size();
+  prefix_ids_.emplace(prefix, last_prefix_);
+  prefixes_.push_back(std::move(prefix));
+  return last_prefix_;
+}
+
+std::string ChunkPaths::path(uint32_t id, int64_t modcount,
+                             XLogRecPtr lsn) const {
+  if (id & kWholePath) {
+    return whole_[id & ~kWholePath];
+  }
+  return make_yezzey_url(prefixes_[id], modcount, lsn);
+}
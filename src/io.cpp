@@ -1,17 +1,30 @@
 
 #include "io.h"
 
+#include "gucs.h"
 #include "io_adv.h"
 #include "util.h"
 
 #include "virtual_index.h"
 
+#include <exception>
+
+extern "C" {
+#include "storage/ipc.h"
+}
+
 #define USE_YPX_READER 1
 #define USE_YPX_WRITER 1
 
 #define USE_WLG_WRITER 0
 #define USE_WLG_READER 0
 
+/*
+ * Writes at least that large are not worth copying into write buffer, they
+ * are sent as is (zero-copy with writev) after what is buffered.
+ */
+const size_t kDirectWriteSize = 256 * 1024;
+
 #if USE_YPX_READER
 #include "yproxy.h"
 #endif
@@ -33,7 +46,8 @@ YIO::YIO(std::shared_ptr<IOadv> adv, ssize_t segindx, ssize_t modcount,
       order_(YezzeyVirtualGetOrder(YezzeyFindAuxIndex(adv->reloid), adv->reloid,
                                    adv->coords_.filenode, adv->coords_.blkno)) {
 #if USE_YPX_READER
-  reader_ = std::make_shared<YProxyReader>(adv_, segindx_, order_);
+  reader_ = std::make_shared<YProxyReader>(adv_, segindx_, order_,
+                                           yezzey_read_ahead_chunks);
 
 #else
 #error "Unsupported storage read configuration"
@@ -53,7 +67,8 @@ YIO::YIO(std::shared_ptr<IOadv> adv, ssize_t segindx)
       order_(YezzeyVirtualGetOrder(YezzeyFindAuxIndex(adv->reloid), adv->reloid,
                                    adv->coords_.filenode, adv->coords_.blkno)) {
 #if USE_YPX_READER
-  reader_ = std::make_shared<YProxyReader>(adv_, segindx_, order_);
+  reader_ = std::make_shared<YProxyReader>(adv_, segindx_, order_,
+                                           yezzey_read_ahead_chunks);
 
 #else
 #error "Unsupported storage read configuration"
@@ -65,17 +80,104 @@ bool YIO::io_read(char *buffer, size_t *amount) {
     *amount = -1;
     return false;
   }
+  if (yezzey_fill_read_buffer) {
+    return reader_->readFull(buffer, amount);
+  }
   return reader_->read(buffer, amount);
 }
 
+bool YIO::io_read_some(char *buffer, size_t *amount) {
+  if (reader_.get() == nullptr) {
+    *amount = -1;
+    return false;
+  }
+  return reader_->read(buffer, amount);
+}
+
+int YIO::io_read_poll_fd() {
+  return reader_.get() == nullptr ? -1 : reader_->pollFd();
+}
+
+int YIO::io_read_syscalls() {
+  return reader_.get() == nullptr ? 0 : reader_->lastReadSyscalls();
+}
+
+bool YIO::io_seek(int64_t offset) {
+  if (reader_.get() == nullptr) {
+    return false;
+  }
+  return reader_->seek(offset);
+}
+
+int64_t YIO::io_tell() {
+  return reader_.get() == nullptr ? 0 : reader_->tell();
+}
+
 bool YIO::io_write(char *buffer, size_t *amount) {
   if (writer_.get() == nullptr) {
     *amount = -1;
     return false;
   }
 
-  /* insert new chuck in yezzey virtual index */
-  return writer_->write(buffer, amount);
+  if (write_failed_) {
+    *amount = 0;
+    return false;
+  }
+
+  const size_t limit = (size_t)yezzey_write_buffer_size * 1024;
+  const bool direct = *amount >= std::min(limit, kDirectWriteSize);
+
+  if (direct || write_buf_.size() + *amount > limit) {
+    if (!io_flush()) {
+      *amount = 0;
+      return false;
+    }
+  }
+
+  if (direct) {
+    /* large enough to go as is */
+    if (!writer_->write(buffer, amount)) {
+      write_failed_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  if (write_buf_.capacity() < limit) {
+    write_buf_.reserve(limit);
+  }
+  write_buf_.insert(write_buf_.end(), buffer, buffer + *amount);
+  return true;
+}
+
+bool YIO::io_write_nonblocking(const char *buffer, size_t amount,
+                               size_t *sent) {
+  if (writer_.get() == nullptr || !io_flush()) {
+    return false;
+  }
+  return writer_->writeNonBlocking(buffer, amount, sent);
+}
+
+int YIO::io_write_poll_fd() {
+  return writer_.get() == nullptr ? -1 : writer_->pollFd();
+}
+
+bool YIO::io_flush() {
+  if (write_failed_) {
+    return false;
+  }
+  if (write_buf_.empty()) {
+    return true;
+  }
+
+  size_t amount = write_buf_.size();
+  const auto rc = writer_->write(write_buf_.data(), &amount);
+  write_buf_.clear();
+  if (!rc || amount == 0) {
+    write_failed_ = true;
+    return false;
+  }
+  return true;
 }
 
 bool YIO::io_close() {
@@ -85,12 +187,37 @@ bool YIO::io_close() {
     rrs = reader_->close();
   }
   if (writer_.get()) {
-    wrs = writer_->close();
+    wrs = io_flush();
+    wrs = writer_->close() && wrs;
   }
   return rrs && wrs;
 }
 
-YIO::~YIO() { io_close(); }
+YIO::~YIO() {
+  const bool unsent = !write_buf_.empty();
+  if (io_close() || !(unsent || write_failed_)) {
+    return;
+  }
+
+  /*
+   * Data of running transaction is lost, that is an error. Everything is
+   * released first, as ERROR does not return here. In abort, on exit or
+   * while unwinding there is nothing to save, only report it.
+   */
+  reader_.reset();
+  writer_.reset();
+  adv_.reset();
+  std::vector<char>().swap(write_buf_);
+  std::vector<ChunkInfo>().swap(order_);
+
+  if (IsTransactionState() && !proc_exit_inprogress &&
+      !std::uncaught_exception()) {
+    elog(ERROR, "yezzey: failed to complete write to external storage, "
+                "written data is lost");
+  }
+  elog(WARNING, "yezzey: failed to complete write to external storage, "
+                "written data is lost");
+}
 
 bool YIO::reader_empty() {
   return reader_.get() == nullptr ? true : reader_->empty();
@@ -0,0 +1,383 @@
+#include "io_engine.h"
+#include "gucs.h"
+#include "pg.h"
+
+#include <memory>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+std::vector<int> IOEngine::writeBatch(
+    const std::vector<std::pair<int, const std::vector<char> *>> &reqs) {
+  std::vector<int> res(reqs.size());
+  for (size_t i = 0; i < reqs.size(); ++i) {
+    res[i] =
+        writeFull(reqs[i].first, reqs[i].second->data(), reqs[i].second->size());
+  }
+  return res;
+}
+
+int IOEngine::writevFull(int fd, struct iovec *iov, int iovcnt) {
+  while (iovcnt > 0) {
+    CHECK_FOR_INTERRUPTS();
+    auto rc = ::writev(fd, iov, iovcnt);
+
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (rc == 0) {
+      return -1;
+    }
+
+    /* skip what was written */
+    while (iovcnt > 0 && (size_t)rc >= iov->iov_len) {
+      rc -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + rc;
+      iov->iov_len -= rc;
+    }
+  }
+  return 0;
+}
+
+ssize_t SyscallIOEngine::read(int fd, void *buf, size_t len) {
+  while (true) {
+    const auto rc = ::read(fd, buf, len);
+    if (rc < 0 && errno == EINTR) {
+      CHECK_FOR_INTERRUPTS();
+      continue;
+    }
+    return rc;
+  }
+}
+
+int SyscallIOEngine::readFull(int fd, void *buf, size_t len) {
+  size_t offset = 0;
+  while (len > 0) {
+    CHECK_FOR_INTERRUPTS();
+    const auto rc = ::read(fd, static_cast<char *>(buf) + offset, len);
+
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (rc == 0) {
+      // EOF
+      return -1;
+    }
+    len -= rc;
+    offset += rc;
+  }
+  return 0;
+}
+
+int SyscallIOEngine::writeFull(int fd, const void *buf, size_t len) {
+  size_t offset = 0;
+  while (len > 0) {
+    CHECK_FOR_INTERRUPTS();
+    const auto rc = ::write(fd, static_cast<const char *>(buf) + offset, len);
+
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (rc == 0) {
+      return -1;
+    }
+    len -= rc;
+    offset += rc;
+  }
+  return 0;
+}
+
+#ifdef HAVE_LIBURING
+
+const unsigned kUringQueueDepth = 64;
+/* completions are awaited in slices, to notice interrupts */
+const long long kUringWaitSliceNs = 100 * 1000 * 1000;
+/* tag of cancel requests, tags of regular requests start from 1 */
+const uint64_t kUringCancelTag = 0;
+
+/*
+ * io_uring engine. Single reads and writes cost the same one syscall as
+ * plain ones, the gain comes from writeBatch, which submits requests to
+ * many sockets with one io_uring_enter.
+ *
+ * Each request is tagged, and a call returns only when all of its own
+ * completions are reaped, so no request is in flight between calls: the
+ * kernel never writes into a buffer its caller has freed, and no stale
+ * completion is left for the next call. On interrupt, requests in flight
+ * are cancelled and reaped before CHECK_FOR_INTERRUPTS may error out.
+ */
+class UringIOEngine : public IOEngine {
+public:
+  static std::unique_ptr<UringIOEngine> create() {
+    std::unique_ptr<UringIOEngine> e(new UringIOEngine());
+    const auto rc = io_uring_queue_init(kUringQueueDepth, &e->ring_, 0);
+    if (rc < 0) {
+      errno = -rc;
+      elog(WARNING, "yezzey: could not set up io_uring: %m");
+      return nullptr;
+    }
+    e->initialized_ = true;
+    return e;
+  }
+
+  ~UringIOEngine() {
+    if (initialized_) {
+      io_uring_queue_exit(&ring_);
+    }
+  }
+
+  /* ring failed and was torn down, syscall engine is to be used */
+  bool broken() const { return !initialized_; }
+
+  ssize_t read(int fd, void *buf, size_t len) override {
+    auto sqe = getSqe();
+    if (sqe == nullptr) {
+      return fallback_.read(fd, buf, len);
+    }
+    /* offset -1: current file position, works for sockets and files */
+    io_uring_prep_read(sqe, fd, buf, len, (uint64_t)-1);
+    return complete(sqe);
+  }
+
+  int readFull(int fd, void *buf, size_t len) override {
+    size_t offset = 0;
+    while (len > 0) {
+      CHECK_FOR_INTERRUPTS();
+      const auto rc = read(fd, static_cast<char *>(buf) + offset, len);
+      if (rc <= 0) {
+        return -1;
+      }
+      len -= rc;
+      offset += rc;
+    }
+    return 0;
+  }
+
+  int writeFull(int fd, const void *buf, size_t len) override {
+    size_t offset = 0;
+    while (len > 0) {
+      CHECK_FOR_INTERRUPTS();
+      auto sqe = getSqe();
+      if (sqe == nullptr) {
+        return fallback_.writeFull(fd, static_cast<const char *>(buf) + offset,
+                                   len);
+      }
+      io_uring_prep_send(sqe, fd, static_cast<const char *>(buf) + offset, len,
+                         MSG_NOSIGNAL);
+      const auto rc = complete(sqe);
+      if (rc <= 0) {
+        return -1;
+      }
+      len -= rc;
+      offset += rc;
+    }
+    return 0;
+  }
+
+  std::vector<int>
+  writeBatch(const std::vector<std::pair<int, const std::vector<char> *>>
+                 &reqs) override {
+    std::vector<int> res(reqs.size(), -1);
+
+    for (size_t start = 0; start < reqs.size(); start += kUringQueueDepth) {
+      const size_t end = std::min<size_t>(reqs.size(), start + kUringQueueDepth);
+      const auto first = next_tag_;
+      size_t n = 0;
+
+      for (size_t i = start; i < end; ++i, ++n) {
+        auto sqe = getSqe();
+        if (sqe == nullptr) {
+          break;
+        }
+        io_uring_prep_send(sqe, reqs[i].first, reqs[i].second->data(),
+                           reqs[i].second->size(), MSG_NOSIGNAL);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)(first + n));
+      }
+      next_tag_ += n;
+
+      std::vector<int> sent(n, -1);
+      const bool reaped = n == 0 || wait(first, n, sent.data());
+      /* nothing is in flight now */
+      CHECK_FOR_INTERRUPTS();
+
+      for (size_t k = 0; k < n; ++k) {
+        const auto i = start + k;
+        const auto &msg = *reqs[i].second;
+        if (!reaped || sent[k] < 0) {
+          continue;
+        }
+        /* short send: finish synchronously */
+        res[i] = (size_t)sent[k] == msg.size()
+                     ? 0
+                     : fallback_.writeFull(reqs[i].first, msg.data() + sent[k],
+                                           msg.size() - sent[k]);
+      }
+      /* submission queue was full or ring is gone */
+      for (size_t i = start + n; i < end; ++i) {
+        res[i] = fallback_.writeFull(reqs[i].first, reqs[i].second->data(),
+                                     reqs[i].second->size());
+      }
+    }
+    return res;
+  }
+
+private:
+  UringIOEngine() = default;
+
+  /* next free submission entry, nullptr if there is none */
+  struct io_uring_sqe *getSqe() {
+    if (!initialized_) {
+      return nullptr;
+    }
+    auto sqe = io_uring_get_sqe(&ring_);
+    if (sqe == nullptr) {
+      (void)io_uring_submit(&ring_);
+      sqe = io_uring_get_sqe(&ring_);
+    }
+    return sqe;
+  }
+
+  /* submit single prepared request and wait for its result */
+  ssize_t complete(struct io_uring_sqe *sqe) {
+    const auto tag = next_tag_++;
+    int res;
+
+    io_uring_sqe_set_data(sqe, (void *)(uintptr_t)tag);
+    if (!wait(tag, 1, &res)) {
+      errno = EIO;
+      return -1;
+    }
+    /* nothing is in flight now */
+    CHECK_FOR_INTERRUPTS();
+
+    if (res < 0) {
+      errno = -res;
+      return -1;
+    }
+    return res;
+  }
+
+  /*
+   * Submit prepared requests tagged [first, first + n) and reap all their
+   * completions into results. Requests are cancelled on interrupt, but
+   * still waited for. False if ring failed, it is torn down then.
+   */
+  bool wait(uint64_t first, size_t n, int *results) {
+    std::vector<bool> done(n, false);
+    size_t left = n;
+    bool cancelled = false;
+
+    if (io_uring_submit(&ring_) < 0) {
+      teardown();
+      return false;
+    }
+
+    while (left > 0) {
+      struct __kernel_timespec ts;
+      struct io_uring_cqe *cqe;
+
+      ts.tv_sec = 0;
+      ts.tv_nsec = kUringWaitSliceNs;
+      const auto rc = io_uring_wait_cqe_timeout(&ring_, &cqe, &ts);
+      if (rc == -ETIME || rc == -EINTR) {
+        if (InterruptPending && !cancelled) {
+          cancel(first, done);
+          cancelled = true;
+        }
+        continue;
+      }
+      if (rc < 0) {
+        teardown();
+        return false;
+      }
+
+      const auto tag = (uint64_t)(uintptr_t)io_uring_cqe_get_data(cqe);
+      const auto res = cqe->res;
+      io_uring_cqe_seen(&ring_, cqe);
+
+      /* completions of cancel requests are of no interest */
+      if (tag == kUringCancelTag || tag < first || tag - first >= n ||
+          done[tag - first]) {
+        continue;
+      }
+      done[tag - first] = true;
+      results[tag - first] = res;
+      --left;
+    }
+    return true;
+  }
+
+  void cancel(uint64_t first, const std::vector<bool> &done) {
+    for (size_t k = 0; k < done.size(); ++k) {
+      if (done[k]) {
+        continue;
+      }
+      auto sqe = getSqe();
+      if (sqe == nullptr) {
+        break;
+      }
+      io_uring_prep_cancel(sqe, (void *)(uintptr_t)(first + k), 0);
+      io_uring_sqe_set_data(sqe, (void *)(uintptr_t)kUringCancelTag);
+    }
+    (void)io_uring_submit(&ring_);
+  }
+
+  /* ring exit cancels requests still in flight */
+  void teardown() {
+    if (initialized_) {
+      io_uring_queue_exit(&ring_);
+      initialized_ = false;
+      elog(WARNING, "yezzey: io_uring failed, using syscalls");
+    }
+  }
+
+  struct io_uring ring_;
+  bool initialized_{false};
+  uint64_t next_tag_{kUringCancelTag + 1};
+  SyscallIOEngine fallback_;
+};
+
+#endif
+
+IOEngine &IOEngine::get() {
+  static SyscallIOEngine syscall_engine;
+  static bool fallback_reported = false;
+
+  if (yezzey_io_engine != YEZZEY_IO_ENGINE_URING) {
+    return syscall_engine;
+  }
+
+#ifdef HAVE_LIBURING
+  static std::unique_ptr<UringIOEngine> uring_engine;
+  static bool uring_failed = false;
+
+  if (!uring_failed && uring_engine == nullptr) {
+    uring_engine = UringIOEngine::create();
+    uring_failed = uring_engine == nullptr;
+  }
+  if (uring_engine != nullptr && !uring_engine->broken()) {
+    return *uring_engine;
+  }
+#endif
+
+  if (!fallback_reported) {
+    elog(WARNING, "yezzey: io_uring engine is not available, using syscalls");
+    fallback_reported = true;
+  }
+  return syscall_engine;
+}
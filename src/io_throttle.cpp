@@ -0,0 +1,126 @@
+/*
+ *
+ * file: src/io_throttle.cpp
+ */
+
+#include "io_throttle.h"
+#include "gucs.h"
+#include "token_bucket.h"
+
+extern "C" {
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+}
+
+#include <chrono>
+
+/* throttled backend rechecks its budget that often */
+const double kThrottleRecheckMs = 100;
+
+typedef struct IOThrottleCtl {
+  slock_t mutex;
+  /* bytes and requests of each class */
+  TokenBucket bytes[2];
+  TokenBucket requests[2];
+} IOThrottleCtl;
+
+static IOThrottleCtl *throttle = NULL;
+
+static double nowMs() {
+  /* steady clock is system-wide, so buckets may be shared by processes */
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void YezzeyIOThrottleShmemRequest(void) {
+  RequestAddinShmemSpace(sizeof(IOThrottleCtl));
+}
+
+void YezzeyIOThrottleShmemInit(void) {
+  bool found;
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  throttle = (IOThrottleCtl *)ShmemInitStruct(
+      "yezzey io throttle", sizeof(IOThrottleCtl), &found);
+
+  if (!found) {
+    const auto now = nowMs();
+    SpinLockInit(&throttle->mutex);
+    for (int i = 0; i < 2; ++i) {
+      tokenBucketInit(&throttle->bytes[i], now);
+      tokenBucketInit(&throttle->requests[i], now);
+    }
+  }
+
+  LWLockRelease(AddinShmemInitLock);
+}
+
+static double bytesRate(YezzeyIOClass cls) {
+  const auto limit = cls == YezzeyIOClass::Background
+                         ? yezzey_background_bandwidth_limit
+                         : yezzey_foreground_bandwidth_limit;
+  return (double)limit * 1024 * 1024;
+}
+
+static double requestsRate(YezzeyIOClass cls) {
+  return cls == YezzeyIOClass::Background ? yezzey_background_iops_limit
+                                          : yezzey_foreground_iops_limit;
+}
+
+/* caller holds mutex */
+static void refill(YezzeyIOClass cls, double now) {
+  const auto i = (int)cls;
+  tokenBucketRefill(&throttle->bytes[i], now, bytesRate(cls));
+  tokenBucketRefill(&throttle->requests[i], now, requestsRate(cls));
+}
+
+/* caller holds mutex */
+static double waitMs(YezzeyIOClass cls) {
+  const auto i = (int)cls;
+  return std::max(tokenBucketWaitMs(&throttle->bytes[i], bytesRate(cls)),
+                  tokenBucketWaitMs(&throttle->requests[i], requestsRate(cls)));
+}
+
+void YezzeyIOThrottle(YezzeyIOClass cls, int64_t bytes, int requests) {
+  const auto bg = YezzeyIOClass::Background;
+
+  if (throttle == NULL || (bytes == 0 && requests == 0)) {
+    return;
+  }
+  if (bytesRate(cls) <= 0 && requestsRate(cls) <= 0 &&
+      (cls == bg || (bytesRate(bg) <= 0 && requestsRate(bg) <= 0))) {
+    return;
+  }
+
+  SpinLockAcquire(&throttle->mutex);
+  const auto now = nowMs();
+  refill(cls, now);
+  tokenBucketTake(&throttle->bytes[(int)cls], bytes, -1);
+  tokenBucketTake(&throttle->requests[(int)cls], requests, -1);
+  if (cls != bg) {
+    /*
+     * Foreground traffic takes background budget as well, but does not
+     * wait for it. Debt is bounded by one second of background rate.
+     */
+    refill(bg, now);
+    tokenBucketTake(&throttle->bytes[(int)bg], bytes, bytesRate(bg));
+    tokenBucketTake(&throttle->requests[(int)bg], requests, requestsRate(bg));
+  }
+  auto wait_ms = waitMs(cls);
+  SpinLockRelease(&throttle->mutex);
+
+  /* budget is rechecked, foreground traffic may push background back */
+  while (wait_ms > 0) {
+    CHECK_FOR_INTERRUPTS();
+    pg_usleep((long)(std::min(wait_ms, kThrottleRecheckMs) * 1000));
+
+    SpinLockAcquire(&throttle->mutex);
+    refill(cls, nowMs());
+    wait_ms = waitMs(cls);
+    SpinLockRelease(&throttle->mutex);
+  }
+}
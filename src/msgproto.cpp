@@ -96,4 +96,70 @@ MsgBuilder &MsgBuilder::addBytes(const char *bytes, ssize_t len) {
   return *this;
 }
 
-std::vector<char> MsgBuilder::get() { return data; }
\ No newline at end of file
+std::vector<char> MsgBuilder::get() { return data; }
+
+static void encodeBE64(char *buf, uint64_t val) {
+  for (ssize_t i = UINT64_SZ - 1; i >= 0; --i) {
+    buf[i] = val & 0xff;
+    val >>= 8;
+  }
+}
+
+void EncodeCopyDataHeader(char *buf, uint64_t amount) {
+  encodeBE64(buf, COPY_DATA_HEADER_SIZE + amount);
+  buf[MSG_HEADER_SIZE] = MessageTypeCopyData;
+  memset(buf + MSG_HEADER_SIZE + 1, 0, PROTO_HEADER_SIZE - 1);
+  encodeBE64(buf + MSG_HEADER_SIZE + PROTO_HEADER_SIZE, amount);
+}
+
+std::vector<char> ConstructStreamFrame(uint64_t stream_id,
+                                       const std::vector<char> &msg) {
+  return MsgBuilder()
+      .fieldProto()
+      .fieldUInt64()
+      .fieldBytes(msg.size())
+      .endDescription()
+      .addProto(MessageTypeStreamFrame)
+      .addUInt64(stream_id)
+      .addBytes(msg.data(), msg.size())
+      .get();
+}
+
+std::vector<char> ConstructStreamClose(uint64_t stream_id) {
+  return MsgBuilder()
+      .fieldProto()
+      .fieldUInt64()
+      .endDescription()
+      .addProto(MessageTypeStreamClose)
+      .addUInt64(stream_id)
+      .get();
+}
+
+bool ParseStreamFrame(const std::vector<char> &body, uint64_t *stream_id,
+                      size_t *msg_offset) {
+  const size_t off = PROTO_HEADER_SIZE + UINT64_SZ;
+  if (body.size() < off + MSG_HEADER_SIZE ||
+      body[0] != MessageTypeStreamFrame) {
+    return false;
+  }
+
+  uint64_t id = 0;
+  for (size_t i = 0; i < UINT64_SZ; i++) {
+    id <<= 8;
+    id += uint8_t(body[PROTO_HEADER_SIZE + i]);
+  }
+
+  /* wrapped message length must match what is left */
+  uint64_t len = 0;
+  for (size_t i = 0; i < MSG_HEADER_SIZE; i++) {
+    len <<= 8;
+    len += uint8_t(body[off + i]);
+  }
+  if (id == 0 || len != body.size() - off) {
+    return false;
+  }
+
+  *stream_id = id;
+  *msg_offset = off;
+  return true;
+}
@@ -11,37 +11,21 @@
 #include "storage.h"
 
 /*
- * yezzey_offload_relation_internal_rel: do the offloading job
- * aorel should be locked in AccessExclusiveLock
+ * relationSegmentTasks: list segment files of AO/AOCS relation with their
+ * modcounts and logical eofs. In AOCS case, one file per column.
  */
-void yezzey_offload_relation_internal_rel(Relation aorel, bool remove_locally,
-                                          const char *external_storage_path) {
+static std::vector<SegmentOffloadTask> relationSegmentTasks(Relation aorel) {
   int total_segfiles;
   FileSegInfo **segfile_array;
   AOCSFileSegInfo **segfile_array_cs;
 
   auto nvp = aorel->rd_att->natts;
+  std::vector<SegmentOffloadTask> tasks;
 
 #if IsModernYezzey
   Oid segrelid;
 #endif
 
-  /*
-   * Relation segments named base/DBOID/YezzeyGetRelFileLocator(aorel).*
-   */
-
-#if IsModernYezzey
-  elog(yezzey_log_level, "offloading relation %s, relnode %u",
-       RelationGetRelationName(aorel),
-       YezzeyGetRelNode(YezzeyGetRelFileLocator(aorel)));
-#else
-  elog(yezzey_log_level, "offloading relation %s, relnode %d",
-       RelationGetRelationName(aorel),
-       YezzeyGetRelNode(YezzeyGetRelFileLocator(aorel)));
-#endif
-
-  /* for now, we locked relation */
-
   /* GetAllFileSegInfo_pg_aoseg_rel */
 
   /* acquire snapshot for aoseg table lookup */
@@ -66,9 +50,7 @@ void yezzey_offload_relation_internal_rel(Relation aorel, bool remove_locally,
            "offloading segment no %d, modcount %ld up to logial eof %ld", segno,
            modcount, logicalEof);
 
-      offloadRelationSegment(aorel, segno, modcount, logicalEof,
-                             external_storage_path);
-      /* segment if offloaded */
+      tasks.push_back({segno, modcount, logicalEof});
     }
 
     if (segfile_array) {
@@ -100,9 +82,7 @@ void yezzey_offload_relation_internal_rel(Relation aorel, bool remove_locally,
              "eof %ld",
              segno, pseudosegno, modcount, logicalEof);
 
-        offloadRelationSegment(aorel, pseudosegno, modcount, logicalEof,
-                               external_storage_path);
-        /* segment if offloaded */
+        tasks.push_back({pseudosegno, modcount, logicalEof});
       }
     }
 
@@ -114,6 +94,34 @@ void yezzey_offload_relation_internal_rel(Relation aorel, bool remove_locally,
     elog(ERROR, "wrong relation storage type, not AO/AOCS");
   }
 
+  return tasks;
+}
+
+/*
+ * yezzey_offload_relation_internal_rel: do the offloading job
+ * aorel should be locked in AccessExclusiveLock
+ */
+void yezzey_offload_relation_internal_rel(Relation aorel, bool remove_locally,
+                                          const char *external_storage_path) {
+  /*
+   * Relation segments named base/DBOID/YezzeyGetRelFileLocator(aorel).*
+   */
+
+#if IsModernYezzey
+  elog(yezzey_log_level, "offloading relation %s, relnode %u",
+       RelationGetRelationName(aorel),
+       YezzeyGetRelNode(YezzeyGetRelFileLocator(aorel)));
+#else
+  elog(yezzey_log_level, "offloading relation %s, relnode %d",
+       RelationGetRelationName(aorel),
+       YezzeyGetRelNode(YezzeyGetRelFileLocator(aorel)));
+#endif
+
+  /* for now, we locked relation */
+
+  offloadRelationSegments(aorel, relationSegmentTasks(aorel),
+                          external_storage_path);
+
   /* insert entry in relocate table, is no any */
 
   /* cleanup */
@@ -149,3 +157,20 @@ void yezzey_offload_relation_internal(Oid reloid, bool remove_locally,
 
   relation_close(aorel, NoLock);
 }
+
+/*
+ * yezzey_compact_relation_internal:
+ * merges small external storage chunks of offloaded relation. Locks
+ * writers out, so chunks are not appended meanwhile.
+ * Readers see either old chunks or merged ones, depending on snapshot.
+ */
+int64 yezzey_compact_relation_internal(Oid reloid) {
+  auto aorel = relation_open(reloid, ExclusiveLock);
+
+  const auto compacted =
+      compactRelationSegments(aorel, relationSegmentTasks(aorel));
+
+  relation_close(aorel, NoLock);
+
+  return compacted;
+}
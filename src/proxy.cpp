@@ -138,6 +138,10 @@ int64 yezzey_FileSeek(SMGRFile file, int64 offset, int whence) {
     YVirtFD_cache[file].offset = offset;
     /* TDB: check sanity of this operation */
     YVirtFD_cache[file].op_start_offset = offset;
+    /* reposition external storage reader, this is lazy and cheap */
+    if (YVirtFD_cache[file].handler) {
+      (void)YVirtFD_cache[file].handler->io_seek(offset);
+    }
     return offset;
   }
   elog(yezzey_ao_log_level,
@@ -156,7 +160,11 @@ EXTERNC int yezzey_FileSync(SMGRFile file)
   File actual_fd = YVirtFD_cache[file].y_vfd;
   if (actual_fd == YEZZEY_OFFLOADED_FD) {
     /* s3 always sync ? */
-    /* sync tmp buf file here */
+    auto &handler = YVirtFD_cache[file].handler;
+    if (handler && !RecoveryInProgress() && !handler->io_flush()) {
+      elog(WARNING, "failed to flush writes to external storage");
+      return -1;
+    }
     return 0;
   }
   elog(yezzey_ao_log_level, "file sync with fd %d actual %d", file, actual_fd);
@@ -363,6 +371,8 @@ void yezzey_FileClose(SMGRFile file) {
 #ifdef DISKCACHE
 /* CACHE_LOCAL_WRITES_FEATURE to do*/
 #endif
+  /* handler may raise ERROR when destroyed, drop it while entry is intact */
+  yfd.handler.reset();
   YVirtFD_cache.erase(file);
 }
 
@@ -460,6 +470,19 @@ int yezzey_FileRead(SMGRFile file, char *buffer, int amount) {
 
   File actual_fd = yfd.y_vfd;
   if (actual_fd == YEZZEY_OFFLOADED_FD) {
+#if IsModernYezzey
+    /*
+     * Random access (block directory lookups, AOCS column fetches):
+     * start reading from the chunk containing requested offset.
+     */
+    if (offset != yfd.handler->io_tell() &&
+        !yfd.handler->io_seek(offset)) {
+      elog(yezzey_ao_log_level,
+           "yezzey_FileRead: failed to seek to offset %ld with %d",
+           (long)offset, file);
+      return -1;
+    }
+#endif
     if (yfd.handler->reader_empty()) {
       if (yfd.localTmpVfd <= 0) {
         return 0;
@@ -484,11 +507,14 @@ int yezzey_FileRead(SMGRFile file, char *buffer, int amount) {
 
     elog(yezzey_ao_log_level,
 #if PG_VERSION_NUM >= 160000
-         "yezzey_FileRead: file read with %d, actual %d, amount %ld real %ld",
-         file, actual_fd, (long)amount, (long)curr);
+         "yezzey_FileRead: file read with %d, actual %d, amount %ld real %ld, "
+         "syscalls %d",
+         file, actual_fd, (long)amount, (long)curr,
+         yfd.handler->io_read_syscalls());
 #else
-         "yezzey_FileRead: file read with %d, actual %d, amount %d real %ld",
-         file, actual_fd, amount, curr);
+         "yezzey_FileRead: file read with %d, actual %d, amount %d real %ld, "
+         "syscalls %d",
+         file, actual_fd, amount, curr, yfd.handler->io_read_syscalls());
 #endif
     return curr;
   }
@@ -0,0 +1,231 @@
+#include "shm_ring_transport.h"
+#include "msgproto.h"
+#include "yproxy_connector.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/* yproxy not answering RingSetup within that does not support the ring */
+const int kRingSetupTimeoutMs = 1000;
+
+/* producer facing full ring checks for interrupts that often */
+const int kRingFullWaitSliceMs = 100;
+
+ShmRingTransport::ShmRingTransport(int memfd, int eventfd, void *base,
+                                   size_t mapped)
+    : memfd_(memfd), eventfd_(eventfd), base_(base), mapped_(mapped),
+      ring_(base) {}
+
+ShmRingTransport::~ShmRingTransport() {
+  munmap(base_, mapped_);
+  ::close(memfd_);
+  ::close(eventfd_);
+}
+
+/* send message with fds attached as SCM_RIGHTS */
+static int sendWithFds(int sock, const std::vector<char> &msg, const int *fds,
+                       int nfds) {
+  struct iovec iov;
+  iov.iov_base = (void *)msg.data();
+  iov.iov_len = msg.size();
+
+  union {
+    char buf[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control.buf;
+  mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+
+  auto cmsg = CMSG_FIRSTHDR(&mh);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+
+  ssize_t rc;
+  do {
+    rc = sendmsg(sock, &mh, 0);
+  } while (rc < 0 && errno == EINTR);
+  if (rc <= 0) {
+    return -1;
+  }
+
+  /* fds went with the first byte, rest is plain data */
+  if ((size_t)rc < msg.size()) {
+    return commonWriteFull(sock, std::vector<char>(msg.begin() + rc, msg.end()));
+  }
+  return 0;
+}
+
+std::unique_ptr<ShmRingTransport>
+ShmRingTransport::negotiate(int sock, size_t capacity) {
+#ifdef __NR_memfd_create
+  const int memfd = syscall(__NR_memfd_create, "yezzey_ring", MFD_CLOEXEC);
+#else
+  const int memfd = -1;
+  errno = ENOSYS;
+#endif
+  if (memfd == -1) {
+    elog(WARNING, "yezzey: could not create shared memory ring: %m");
+    return nullptr;
+  }
+
+  const auto mapped = ShmRing::mappedSize(capacity);
+  if (ftruncate(memfd, mapped) != 0) {
+    elog(WARNING, "yezzey: could not size shared memory ring: %m");
+    ::close(memfd);
+    return nullptr;
+  }
+
+  const int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (efd == -1) {
+    elog(WARNING, "yezzey: could not create shared memory ring event: %m");
+    ::close(memfd);
+    return nullptr;
+  }
+
+  const auto base =
+      mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (base == MAP_FAILED) {
+    elog(WARNING, "yezzey: could not map shared memory ring: %m");
+    ::close(memfd);
+    ::close(efd);
+    return nullptr;
+  }
+
+  std::unique_ptr<ShmRingTransport> t(
+      new ShmRingTransport(memfd, efd, base, mapped));
+  t->ring_.init(capacity);
+
+  const auto msg = MsgBuilder()
+                       .fieldProto()
+                       .fieldUInt64()
+                       .endDescription()
+                       .addProto(MessageTypeRingSetup)
+                       .addUInt64(capacity)
+                       .get();
+
+  /* yproxy which does not know RingSetup may stay silent */
+  const int fds[2] = {memfd, efd};
+  if (sendWithFds(sock, msg, fds, 2) != 0 ||
+      commonReadRFQResponce(sock, kRingSetupTimeoutMs) != 0) {
+    return nullptr;
+  }
+  return t;
+}
+
+bool ShmRingTransport::waitSpace(int sock) {
+  while (true) {
+    CHECK_FOR_INTERRUPTS();
+
+    struct pollfd pfds[2];
+    pfds[0].fd = eventfd_;
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    pfds[1].fd = sock;
+    pfds[1].events = POLLIN;
+    pfds[1].revents = 0;
+
+    const auto rc = poll(pfds, 2, kRingFullWaitSliceMs);
+    if (rc < 0 && errno != EINTR) {
+      return false;
+    }
+    if (rc <= 0) {
+      continue;
+    }
+    /* yproxy speaks on socket only to report failure */
+    if (pfds[1].revents != 0) {
+      return false;
+    }
+
+    uint64_t events;
+    (void)::read(eventfd_, &events, sizeof(events));
+    return true;
+  }
+}
+
+bool ShmRingTransport::send(int sock, const char *buffer, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    CHECK_FOR_INTERRUPTS();
+    const auto n = ring_.write(buffer + done, len - done);
+    if (n == 0) {
+      /* eventfd is level-triggered, space freed since write is not missed */
+      if (!waitSpace(sock)) {
+        return false;
+      }
+      continue;
+    }
+
+    const auto msg = MsgBuilder()
+                         .fieldProto()
+                         .fieldUInt64()
+                         .endDescription()
+                         .addProto(MessageTypeRingData)
+                         .addUInt64(n)
+                         .get();
+    if (commonWriteFull(sock, msg) == -1) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+ssize_t ShmRingTransport::receive(int sock, char *buffer, size_t len) {
+  if (pending_ == 0) {
+    std::vector<char> header(MSG_HEADER_SIZE);
+    if (commonReadFull(sock, header.data(), MSG_HEADER_SIZE) != 0) {
+      return -1;
+    }
+
+    uint64_t msgLen = 0;
+    for (size_t i = 0; i < MSG_HEADER_SIZE; i++) {
+      msgLen <<= 8;
+      msgLen += uint8_t(header[i]);
+    }
+    if (msgLen < MSG_HEADER_SIZE + PROTO_HEADER_SIZE) {
+      // protocol violation
+      return -1;
+    }
+
+    std::vector<char> body(msgLen - MSG_HEADER_SIZE);
+    if (commonReadFull(sock, body.data(), body.size()) != 0) {
+      return -1;
+    }
+    if (body[0] != MessageTypeRingData ||
+        body.size() != PROTO_HEADER_SIZE + UINT64_SZ) {
+      return 0;
+    }
+
+    for (size_t i = 0; i < UINT64_SZ; i++) {
+      pending_ <<= 8;
+      pending_ += uint8_t(body[PROTO_HEADER_SIZE + i]);
+    }
+  }
+
+  const auto n = ring_.read(buffer, std::min<uint64_t>(len, pending_));
+  if (n == 0) {
+    elog(WARNING, "yezzey: announced payload is missing in shared memory ring");
+    return -1;
+  }
+  pending_ -= n;
+
+  /* wake yproxy if it waits for space */
+  const uint64_t one = 1;
+  (void)::write(eventfd_, &one, sizeof(one));
+  return n;
+}
@@ -3,7 +3,10 @@
 #include "storage.h"
 #include "util.h"
 
+#include <chrono>
+#include <fcntl.h>
 #include <fstream>
+#include <poll.h>
 #include <string>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -14,8 +17,11 @@
 
 #include "cdb/cdbappendonlyxlog.h"
 #include "cdb/cdbvars.h"
+#include "chunk_pool.h"
 #include "gucs.h"
 #include "io.h"
+#include "io_throttle.h"
+#include "meta.h"
 #include "offload_tablespace_map.h"
 #include "relfilelocator.h"
 #include "url.h"
@@ -38,45 +44,172 @@ bool ensureFilepathLocal(const std::string &filepath) {
   return (stat(filepath.c_str(), &buffer) == 0);
 }
 
-int offloadRelationSegmentPath(Relation aorel, std::shared_ptr<IOadv> ioadv,
-                               int64 modcount, int64 logicalEof,
-                               const std::string &external_storage_path) {
-  const std::string localPath = getlocalpath(ioadv->coords_);
+static double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/* ask kernel to start reading segment file range in background */
+static void adviseWillNeed(File vfd, int64 offset, int64 len) {
+#ifdef POSIX_FADV_WILLNEED
+  if (len > 0) {
+    (void)posix_fadvise(FileGetRawDesc(vfd), offset, len, POSIX_FADV_WILLNEED);
+  }
+#endif
+}
+
+/* offload checkpoints of segment files, relative to data directory */
+const char *kOffloadResumeDir = "yezzey_offload_resume";
 
-  if (!ensureFilepathLocal(localPath)) {
+static std::string offloadResumePath(const relnodeCoord &coords) {
+  return std::string(kOffloadResumeDir) + "/" + std::to_string(coords.dboid) +
+         "_" + std::to_string(coords.filenode) + "_" +
+         std::to_string(coords.blkno);
+}
+
+/* fsync file or directory by path, false on failure */
+static bool fsyncPath(const char *path, bool isdir) {
+  const auto fd = ::open(path, isdir ? O_RDONLY : O_RDWR);
+  if (fd == -1) {
+    return false;
+  }
+  const auto rc = fsync(fd);
+  ::close(fd);
+  return rc == 0;
+}
+
+/*
+ * Transfer of one segment file to external storage, split into steps so
+ * that several transfers can be driven from one loop.
+ *
+ * With yezzey.offload_checkpoint_size the file is uploaded in parts of that
+ * size, each with its own Put. Completed parts are listed in a resume file,
+ * so after failed offload the next attempt records them in virtual index
+ * again and continues from the last one. Virtual index orders chunks of
+ * segment file by modcount, unique there, so parts get consecutive
+ * modcounts ending with modcount of the segment file, above those of rows
+ * already recorded. Parts are made larger when there are not enough of
+ * such modcounts.
+ *
+ * Resume file is a local file outside of WAL: mirror promoted after failed
+ * offload starts it over.
+ *
+ * Pieces are read into two buffers: while one is sent with nonblocking
+ * writes, next piece is read into the other, so disk reads overlap with
+ * kernel sending socket buffer to yproxy.
+ */
+class SegmentOffload {
+public:
+  SegmentOffload(Relation aorel, std::shared_ptr<IOadv> ioadv, int64 modcount,
+                 int64 logicalEof, const std::string &external_storage_path)
+      : aorel_(aorel), ioadv_(ioadv), modcount_(modcount),
+        logicalEof_(logicalEof), external_storage_path_(external_storage_path),
+        localPath_(getlocalpath(ioadv->coords_)) {}
+
+  ~SegmentOffload() {
+    if (vfd_ > 0) {
+      FileClose(vfd_);
+    }
+  }
+
+  /* 1 if segment file is to be transferred, 0 if it is not local, -1 on
+   * failure */
+  int start();
+
+  /* read next piece of segment file into free buffer; 0 if nothing was
+   * read */
+  int readChunk();
+
+  /* send whole piece read */
+  bool sendChunk();
+
+  /* send as much of piece read as yproxy socket accepts */
+  bool sendChunkNonBlocking();
+
+  /* yproxy socket to wait on before sendChunkNonBlocking, or -1 */
+  int pollFd() { return iohandler_->io_write_poll_fd(); }
+
+  /* piece read is not sent yet */
+  bool pending() const { return chunk_len_ > 0; }
+
+  bool finished() const { return progress_ >= logicalEof_ && !pending(); }
+
+  /* record transferred data in virtual index and complete upload */
+  void finish();
+
+  const std::string &localPath() const { return localPath_; }
+
+private:
+  /* split upload into parts, and resume it if it was checkpointed */
+  void planParts();
+  /* pick up parts completed by previous attempt */
+  void resume();
+  /* complete Put of current part and start next one */
+  void checkpoint();
+  void recordPart(int64 start, int64 finish, bool encrypted, bool kek,
+                  int64 modcount, XLogRecPtr lsn, const std::string &x_path);
+  /* piece in buffer is sent, go on with the one read ahead */
+  void nextChunk();
+
+  Relation aorel_;
+  std::shared_ptr<IOadv> ioadv_;
+  int64 modcount_;
+  int64 logicalEof_;
+  std::string external_storage_path_;
+  std::string localPath_;
+
+  File vfd_{-1};
+  std::unique_ptr<YIO> iohandler_{nullptr};
+  /* piece being sent and piece read ahead */
+  std::vector<char> buffers_[2];
+  int send_buf_{0};
+
+  int64 offset_start_{0};
+  int64 progress_{0};
+
+  /* 0 if file goes in one Put */
+  int64 checkpoint_size_{0};
+  /* start offset and modcount of part being uploaded */
+  int64 part_start_{0};
+  int64 part_modcount_{0};
+  std::string resume_path_;
+
+  /* bytes of piece being sent, and CopyData frame bytes of it sent */
+  size_t chunk_len_{0};
+  size_t sent_{0};
+  /* bytes of piece read ahead */
+  size_t next_len_{0};
+
+  double started_ms_{0};
+  double read_ms_{0};
+  double send_ms_{0};
+};
+
+int SegmentOffload::start() {
+  if (!ensureFilepathLocal(localPath_)) {
     // nothing to do
     // elog(ERROR, "attempt to offload non-local relation");
     return 0;
   }
 
-  int rc;
-  int tot;
-  /* XXX: chunk size should normally be configurable. */
-  const size_t chunkSize = 1 << 20;
-  int64 curr_read_chunk;
-
-  std::vector<char> buffer(chunkSize);
 #if IsGreenplum6
-  const auto vfd =
-      PathNameOpenFile((FileName)localPath.c_str(), O_RDONLY, 0600);
+  vfd_ = PathNameOpenFile((FileName)localPath_.c_str(), O_RDONLY, 0600);
 #else
-  const auto vfd = PathNameOpenFile(localPath.c_str(), O_RDONLY);
+  vfd_ = PathNameOpenFile(localPath_.c_str(), O_RDONLY);
 #endif
-  if (vfd <= 0) {
+  if (vfd_ <= 0) {
     elog(ERROR,
          "yezzey: failed to open %s file to transfer to external storage",
-         localPath.c_str());
+         localPath_.c_str());
   }
 
-  auto iohandler =
-      YIO(ioadv, GpIdentity.segindex, modcount, external_storage_path);
-
   /* Create external storage reader handle to calculate total external files
    * size. this is needed to skip offloading of data already present in external
    * storage.
    */
   const auto virtual_size = yezzey_calc_virtual_relation_size(
-      ioadv, GpIdentity.segindex, modcount, external_storage_path);
+      ioadv_, GpIdentity.segindex, modcount_, external_storage_path_);
 
   if (virtual_size == -1) {
     elog(NOTICE, "yezzey: failed to calculate virtual size");
@@ -84,155 +217,491 @@ int offloadRelationSegmentPath(Relation aorel, std::shared_ptr<IOadv> ioadv,
   }
 
   elog(NOTICE, "yezzey: relation virtual size calculated: %ld", virtual_size);
-  auto progress = virtual_size;
-  const auto offset_start = progress;
+  progress_ = virtual_size;
+  offset_start_ = progress_;
+
+  part_start_ = progress_;
+  part_modcount_ = modcount_;
+  if (yezzey_offload_checkpoint_size > 0) {
+    planParts();
+  }
+
+  iohandler_ = make_unique<YIO>(ioadv_, GpIdentity.segindex, part_modcount_,
+                                external_storage_path_);
+  YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
 
 #if PG_VERSION_NUM < 120000
-  const auto fLen = FileSeek(vfd, 0L, SEEK_END);
+  const auto fLen = FileSeek(vfd_, 0L, SEEK_END);
 
-  if (fLen < logicalEof) {
+  if (fLen < logicalEof_) {
     elog(ERROR,
          "yezzey: failed to offload corrupt relation, partial data file %s: "
          "%lu < %lu",
-         localPath.c_str(), fLen, logicalEof);
+         localPath_.c_str(), fLen, logicalEof_);
   }
 
   /* reset seek to beginning */
-  FileSeek(vfd, progress, SEEK_SET);
+  FileSeek(vfd_, progress_, SEEK_SET);
 
 #else
-  const auto fLen = FileSize(vfd);
+  const auto fLen = FileSize(vfd_);
 
-  if (fLen < logicalEof) {
+  if (fLen < logicalEof_) {
     elog(ERROR,
          "yezzey: failed to offload corrupt relation, partial data file %s: "
          "%lu < %lu",
-         localPath.c_str(), fLen, logicalEof);
+         localPath_.c_str(), fLen, logicalEof_);
   }
 
 #endif
 
-  ioadv->multipart_upload = fLen > multipart_threshold;
+  ioadv_->multipart_upload = fLen > multipart_threshold;
 
-  while (progress < logicalEof) {
-    CHECK_FOR_INTERRUPTS();
-    curr_read_chunk = chunkSize;
-    if (progress + curr_read_chunk > logicalEof) {
-      /* should not read beyond logical eof */
-      curr_read_chunk = logicalEof - progress;
+  for (auto &buffer : buffers_) {
+    buffer.resize((size_t)yezzey_offload_transfer_size * 1024);
+  }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  (void)posix_fadvise(FileGetRawDesc(vfd_), progress_, logicalEof_ - progress_,
+                      POSIX_FADV_SEQUENTIAL);
+#endif
+  /* piece after the one read ahead is prefetched into page cache */
+  adviseWillNeed(vfd_, progress_,
+                 std::min<int64>(buffers_[0].size(), logicalEof_ - progress_));
+
+  started_ms_ = nowMs();
+  return 1;
+}
+
+void SegmentOffload::planParts() {
+  /* modcounts up to the last one recorded for segment file are taken */
+  int64 last_modcount = 0;
+  for (const auto &chunk :
+       YezzeyVirtualGetOrder(YezzeyFindAuxIndex(aorel_->rd_id),
+                             ioadv_->reloid, ioadv_->coords_.filenode,
+                             ioadv_->coords_.blkno)) {
+    last_modcount = std::max(last_modcount, chunk.modcount);
+  }
+  const auto free_modcounts = modcount_ - last_modcount;
+  if (free_modcounts <= 1) {
+    /* one Put with modcount of segment file */
+    return;
+  }
+
+  const auto left = logicalEof_ - progress_;
+  checkpoint_size_ =
+      std::max<int64>((int64)yezzey_offload_checkpoint_size << 20,
+                      (left + free_modcounts - 1) / free_modcounts);
+  const auto parts = (left + checkpoint_size_ - 1) / checkpoint_size_;
+  part_modcount_ = modcount_ - std::max<int64>(parts - 1, 0);
+
+  resume();
+}
+
+void SegmentOffload::resume() {
+  resume_path_ = offloadResumePath(ioadv_->coords_);
+
+  std::ifstream in(resume_path_);
+  if (!in) {
+    return;
+  }
+
+  int64 modcount, eof, checkpoint_size;
+  if (!(in >> modcount >> eof >> checkpoint_size) || modcount != modcount_ ||
+      eof != logicalEof_ || checkpoint_size != checkpoint_size_) {
+    /* left by offload of other data */
+    in.close();
+    std::remove(resume_path_.c_str());
+    return;
+  }
+
+  int64 start, finish, part_modcount;
+  XLogRecPtr lsn;
+  int encrypted, kek;
+  std::string x_path;
+  while (in >> start >> finish >> part_modcount >> lsn >> encrypted >> kek) {
+    in.ignore(1);
+    if (!std::getline(in, x_path) || start != part_start_ ||
+        part_modcount != part_modcount_) {
+      break;
     }
-    /* code */
+    recordPart(start, finish, encrypted, kek, part_modcount, lsn, x_path);
+    part_start_ = finish;
+    ++part_modcount_;
+  }
+
+  if (part_start_ != progress_) {
+    elog(NOTICE, "yezzey: resuming offload of %s from offset %ld",
+         localPath_.c_str(), part_start_);
+    progress_ = part_start_;
+  }
+}
+
+void SegmentOffload::recordPart(int64 start, int64 finish, bool encrypted,
+                                bool kek, int64 modcount, XLogRecPtr lsn,
+                                const std::string &x_path) {
+  YezzeyUpdateMetadataRelations(
+      YezzeyFindAuxIndex(aorel_->rd_id), ioadv_->reloid,
+      ioadv_->coords_.filenode, ioadv_->coords_.blkno /* blkno*/, start,
+      finish, encrypted, kek, 0 /* reused */, modcount, lsn, x_path.c_str(),
+      yezzey_fqrelname_md5(ioadv_->nspname, ioadv_->relname).c_str());
+}
+
+void SegmentOffload::checkpoint() {
+  /* part is durable only when yproxy acknowledged its Put */
+  if (!iohandler_->io_close()) {
+    elog(ERROR, "yezzey: failed to complete %s offloading", localPath_.c_str());
+  }
+
+  const bool encrypted = ioadv_->use_gpg_crypto;
+  const bool kek = iohandler_->use_kek();
+  const auto lsn = iohandler_->writer_->getInsertionStorageLsn();
+  const auto x_path = iohandler_->writer_->getExternalStoragePath();
+  recordPart(part_start_, progress_, encrypted, kek, part_modcount_, lsn,
+             x_path);
+
+  const bool fresh = !ensureFilepathLocal(resume_path_);
+  const bool new_dir = fresh && mkdir(kOffloadResumeDir, S_IRWXU) == 0;
+  std::ofstream out(resume_path_, std::ios::app);
+  if (fresh) {
+    out << modcount_ << ' ' << logicalEof_ << ' ' << checkpoint_size_ << '\n';
+  }
+  out << part_start_ << ' ' << progress_ << ' ' << part_modcount_ << ' '
+      << lsn << ' ' << encrypted << ' ' << kek << ' ' << x_path << '\n';
+  out.close();
+
+  /* checkpoint must survive crash, and so must file and directory entries */
+  if (!out || !fsyncPath(resume_path_.c_str(), false) ||
+      (fresh && !fsyncPath(kOffloadResumeDir, true)) ||
+      (new_dir && !fsyncPath(".", true))) {
+    /* not fatal, only resume is lost */
+    elog(WARNING, "yezzey: failed to record offload checkpoint in %s: %m",
+         resume_path_.c_str());
+  }
+
+  elog(yezzey_log_level, "yezzey: offload of %s checkpointed at offset %ld",
+       localPath_.c_str(), progress_);
+
+  part_start_ = progress_;
+  ++part_modcount_;
+  iohandler_ = make_unique<YIO>(ioadv_, GpIdentity.segindex, part_modcount_,
+                                external_storage_path_);
+  YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
+}
+
+int SegmentOffload::readChunk() {
+  /* both buffers are taken, or all is read */
+  if (next_len_ > 0 || progress_ >= logicalEof_) {
+    return 0;
+  }
+
+  if (checkpoint_size_ > 0 && progress_ - part_start_ >= checkpoint_size_) {
+    /* part is complete when all of it is sent */
+    if (pending()) {
+      return 0;
+    }
+    checkpoint();
+  }
+
+  auto &buffer = buffers_[pending() ? 1 - send_buf_ : send_buf_];
+
+  /* should not read beyond logical eof, nor part end */
+  auto curr_read_chunk =
+      std::min<int64>(buffer.size(), logicalEof_ - progress_);
+  if (checkpoint_size_ > 0) {
+    curr_read_chunk = std::min<int64>(curr_read_chunk,
+                                      part_start_ + checkpoint_size_ - progress_);
+  }
+
+  const auto read_started_ms = nowMs();
 #if IsGreenplum6
-    rc = FileRead(vfd, buffer.data(), curr_read_chunk);
+  const int rc = FileRead(vfd_, buffer.data(), curr_read_chunk);
 #else
-    rc = FileRead(vfd, buffer.data(), curr_read_chunk, progress,
-                  WAIT_EVENT_DATA_FILE_READ);
+  const int rc = FileRead(vfd_, buffer.data(), curr_read_chunk, progress_,
+                          WAIT_EVENT_DATA_FILE_READ);
 #endif
-    if (rc < 0) {
-      FileClose(vfd);
-      return rc;
-    }
-    if (rc == 0) {
-      /* maube file whipped away, maybe not, retry */
-      continue;
-    }
+  read_ms_ += nowMs() - read_started_ms;
+  if (rc <= 0) {
+    /* on 0 maube file whipped away, maybe not, caller retries */
+    return rc;
+  }
 
-    tot = 0;
-    char *bptr = buffer.data();
+  progress_ += rc;
+  if (pending()) {
+    next_len_ = rc;
+  } else {
+    chunk_len_ = rc;
+    sent_ = 0;
+  }
+  YezzeyIOThrottle(YezzeyIOClass::Background, rc, 0);
 
-    while (tot < rc) {
-      size_t currptrtot = rc - tot;
-      if (!iohandler.io_write(bptr, &currptrtot)) {
-        FileClose(vfd);
-        return -1;
-      }
+  adviseWillNeed(vfd_, progress_,
+                 std::min<int64>(buffer.size(), logicalEof_ - progress_));
+  return rc;
+}
+
+void SegmentOffload::nextChunk() {
+  send_buf_ = 1 - send_buf_;
+  chunk_len_ = next_len_;
+  next_len_ = 0;
+  sent_ = 0;
+}
+
+bool SegmentOffload::sendChunk() {
+  const auto send_started_ms = nowMs();
+  size_t tot = 0;
 
-      tot += currptrtot;
-      bptr += currptrtot;
+  while (tot < chunk_len_) {
+    size_t currptrtot = chunk_len_ - tot;
+    if (!iohandler_->io_write(buffers_[send_buf_].data() + tot,
+                              &currptrtot)) {
+      return false;
     }
+    tot += currptrtot;
+  }
+
+  send_ms_ += nowMs() - send_started_ms;
+  nextChunk();
+  return true;
+}
+
+bool SegmentOffload::sendChunkNonBlocking() {
+  const auto send_started_ms = nowMs();
+  if (!iohandler_->io_write_nonblocking(buffers_[send_buf_].data(),
+                                        chunk_len_, &sent_)) {
+    return false;
+  }
+  send_ms_ += nowMs() - send_started_ms;
 
-    progress += rc;
+  if (sent_ == COPY_DATA_HEADER_SIZE + chunk_len_) {
+    nextChunk();
   }
+  return true;
+}
 
-  const auto offset_finish = progress;
+void SegmentOffload::finish() {
+  const auto offset_finish = progress_;
+
+  const auto total_ms = nowMs() - started_ms_;
+  const double mb = (offset_finish - offset_start_) / (1024.0 * 1024.0);
+  elog(yezzey_log_level,
+       "yezzey: offloaded %.1f MB of %s in %.0f ms (%.1f MB/s), disk read "
+       "%.0f ms, upload %.0f ms",
+       mb, localPath_.c_str(), total_ms,
+       total_ms > 0 ? mb * 1000 / total_ms : 0, read_ms_, send_ms_);
 
   /* data persisted in external storage, we can update out metadata relations */
   /* insert chunk metadata in virtual index  */
-  YezzeyUpdateMetadataRelations(
-      YezzeyFindAuxIndex(aorel->rd_id), ioadv->reloid, ioadv->coords_.filenode,
-      ioadv->coords_.blkno /* blkno*/, offset_start, offset_finish,
-      iohandler.adv_->use_gpg_crypto /* encrypted */, iohandler.use_kek(),
-      0 /* reused */, modcount, iohandler.writer_->getInsertionStorageLsn(),
-      iohandler.writer_->getExternalStoragePath().c_str() /* path */,
-      yezzey_fqrelname_md5(ioadv->nspname, ioadv->relname).c_str());
-
-  if (!iohandler.io_close()) {
-    elog(ERROR, "yezzey: failed to complete %s offloading", localPath.c_str());
+  recordPart(part_start_, offset_finish,
+             iohandler_->adv_->use_gpg_crypto /* encrypted */,
+             iohandler_->use_kek(), part_modcount_,
+             iohandler_->writer_->getInsertionStorageLsn(),
+             iohandler_->writer_->getExternalStoragePath() /* path */);
+
+  if (!iohandler_->io_close()) {
+    elog(ERROR, "yezzey: failed to complete %s offloading", localPath_.c_str());
   } else {
     // debug output
-    elog(DEBUG1, "yezzey: complete %s offloading", localPath.c_str());
+    elog(DEBUG1, "yezzey: complete %s offloading", localPath_.c_str());
   }
 
-  FileClose(vfd);
-  return rc;
+  if (!resume_path_.empty()) {
+    std::remove(resume_path_.c_str());
+  }
+
+  FileClose(vfd_);
+  vfd_ = -1;
 }
 
-void loadSegmentFromExternalStorage(Relation rel, const std::string &nspname,
-                                    const std::string &relname, int segno,
-                                    const relnodeCoord &coords,
-                                    const std::string &dest_path) {
-  /* TODO: pass this as argument? */
-  const size_t chunkSize = 1 << 20;
-  std::vector<char> buffer(chunkSize);
+int offloadRelationSegmentPath(Relation aorel, std::shared_ptr<IOadv> ioadv,
+                               int64 modcount, int64 logicalEof,
+                               const std::string &external_storage_path) {
+  SegmentOffload offload(aorel, ioadv, modcount, logicalEof,
+                         external_storage_path);
+
+  const auto rc = offload.start();
+  if (rc <= 0) {
+    return rc;
+  }
 
-  std::ofstream ostrm(dest_path, std::ios::binary);
+  while (!offload.finished()) {
+    CHECK_FOR_INTERRUPTS();
+    /* first piece, or next one while socket drains the current */
+    if (offload.readChunk() < 0) {
+      return -1;
+    }
+    if (!offload.pending()) {
+      continue;
+    }
 
-  auto ioadv = std::make_shared<IOadv>(
-      nspname, relname, storage_class /* storage_class */, multipart_chunksize,
-      coords /* filename */, rel->rd_id /* reloid */, use_gpg_crypto,
-      yproxy_socket);
+    const auto fd = offload.pollFd();
+    if (fd == -1) {
+      /* multiplexed or shared memory transport, send in place */
+      if (!offload.sendChunk()) {
+        return -1;
+      }
+      continue;
+    }
 
-  /*
-   * Create external storage reader handle to read segment files
-   */
-  auto iohandler = YIO(ioadv, GpIdentity.segindex);
-  size_t position = 0;
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    const auto rc = poll(&pfd, 1, 1000);
+    if (rc < 0 && errno != EINTR) {
+      return -1;
+    }
+    if (rc > 0 && !offload.sendChunkNonBlocking()) {
+      return -1;
+    }
+  }
 
-  YezzeyLocator rnode;
-  /* coords does contain origin tablespace */
-  YezzeyGetRelSpcOid(rnode) = coords.spcNode;
-  YezzeyGetRelDbOid(rnode) = YezzeyGetRelDbOid(YezzeyGetRelFileLocator(rel));
-  YezzeyGetRelNode(rnode) = YezzeyGetRelNode(YezzeyGetRelFileLocator(rel));
+  offload.finish();
+  return 0;
+}
 
-  /*WAL-create new segfile */
-  xlog_ao_insert(rnode, segno, 0, NULL, 0);
+/* segment file is written and WAL-logged in pieces of this size */
+const size_t kLoadExtentSize = 4 << 20;
 
-  while (!iohandler.reader_empty()) {
-    size_t amount = chunkSize;
-    if (!iohandler.io_read(buffer.data(), &amount)) {
-      elog(ERROR, "failed to read file from external storage");
+/*
+ * Transfer of one segment file from external storage, split into steps so
+ * that several transfers can be driven from one loop.
+ */
+class SegmentLoad {
+public:
+  SegmentLoad(Relation rel, const std::string &nspname,
+              const std::string &relname, int segno, const relnodeCoord &coords,
+              const std::string &dest_path)
+      : segno_(segno), dest_path_(dest_path), buffer_(kLoadExtentSize) {
+    auto ioadv = std::make_shared<IOadv>(
+        nspname, relname, storage_class /* storage_class */,
+        multipart_chunksize, coords /* filename */, rel->rd_id /* reloid */,
+        use_gpg_crypto, yproxy_socket);
+
+    /*
+     * Create external storage reader handle to read segment files
+     */
+    iohandler_ = make_unique<YIO>(ioadv, GpIdentity.segindex);
+    iohandler_->reader_->setIOClass(YezzeyIOClass::Background);
+
+    /* coords does contain origin tablespace */
+    YezzeyGetRelSpcOid(rnode_) = coords.spcNode;
+    YezzeyGetRelDbOid(rnode_) = YezzeyGetRelDbOid(YezzeyGetRelFileLocator(rel));
+    YezzeyGetRelNode(rnode_) = YezzeyGetRelNode(YezzeyGetRelFileLocator(rel));
+  }
+
+  ~SegmentLoad() {
+    if (vfd_ > 0) {
+      FileClose(vfd_);
+    }
+  }
+
+  void start() {
+    const int flags = O_CREAT | O_WRONLY | O_TRUNC | PG_BINARY;
+#if IsGreenplum6
+    vfd_ = PathNameOpenFile((FileName)dest_path_.c_str(), flags, 0600);
+#else
+    vfd_ = PathNameOpenFile(dest_path_.c_str(), flags);
+#endif
+    if (vfd_ <= 0) {
+      elog(ERROR, "yezzey: failed to create %s: %m", dest_path_.c_str());
     }
 
-    /* code */
+    /*WAL-create new segfile */
+    xlog_ao_insert(rnode_, segno_, 0, NULL, 0);
+  }
 
-    ostrm.write(buffer.data(), amount);
-    if (ostrm.fail()) {
+  /*
+   * Read next piece of segment file. Unless whole buffer is requested,
+   * it is what yproxy has sent so far. Data is stored once extent is full.
+   */
+  void step(bool fill) {
+    size_t amount = buffer_.size() - fill_;
+    const auto ok =
+        fill ? iohandler_->io_read(buffer_.data() + fill_, &amount)
+             : iohandler_->io_read_some(buffer_.data() + fill_, &amount);
+    if (!ok) {
       elog(ERROR, "failed to read file from external storage");
     }
 
-    xlog_ao_insert(rnode, segno, position, buffer.data(), amount);
-    position += amount;
+    fill_ += amount;
+    if (fill_ == buffer_.size() || finished()) {
+      writeExtent();
+    }
   }
 
-  if (!iohandler.io_close()) {
-    elog(ERROR, "yezzey: failed to complete %s offloading", dest_path.c_str());
-  } else {
-    elog(DEBUG1, "yezzey: complete %s offloading", dest_path.c_str());
+  /* yproxy socket to wait on before step, or -1 */
+  int pollFd() { return iohandler_->io_read_poll_fd(); }
+
+  bool finished() { return iohandler_->reader_empty(); }
+
+  void finish() {
+    writeExtent();
+
+    /* without WAL file content is durable only after sync */
+#if IsModernYezzey
+    const auto rc = FileSync(vfd_, WAIT_EVENT_DATA_FILE_SYNC);
+#else
+    const auto rc = FileSync(vfd_);
+#endif
+    if (rc != 0) {
+      elog(ERROR, "yezzey: failed to sync %s: %m", dest_path_.c_str());
+    }
+    FileClose(vfd_);
+    vfd_ = -1;
+
+    if (!iohandler_->io_close()) {
+      elog(ERROR, "yezzey: failed to complete %s offloading",
+           dest_path_.c_str());
+    } else {
+      elog(DEBUG1, "yezzey: complete %s offloading", dest_path_.c_str());
+    }
   }
-}
 
-void loadRelationSegment(Relation aorel, Oid loadSpcOid, Oid orig_relnode,
-                         int segno, const char *dest_path) {
+private:
+  /* write extent to segment file and WAL-log it */
+  void writeExtent() {
+    if (fill_ == 0) {
+      return;
+    }
+
+#if IsModernYezzey
+    const auto rc = FileWrite(vfd_, buffer_.data(), fill_, position_,
+                              WAIT_EVENT_DATA_FILE_WRITE);
+#else
+    const auto rc = FileWrite(vfd_, buffer_.data(), fill_);
+#endif
+    if (rc < 0 || (size_t)rc != fill_) {
+      elog(ERROR, "yezzey: failed to write %s: %m", dest_path_.c_str());
+    }
+
+    /*
+     * With wal_level minimal there are no standbys to replay data, file
+     * creation is logged and content is synced at finish.
+     */
+    if (XLogIsNeeded()) {
+      xlog_ao_insert(rnode_, segno_, position_, buffer_.data(), fill_);
+    }
+    position_ += fill_;
+    fill_ = 0;
+  }
+
+  int segno_;
+  std::string dest_path_;
+  YezzeyLocator rnode_;
+  std::unique_ptr<YIO> iohandler_{nullptr};
+  std::vector<char> buffer_;
+  /* bytes of current extent in buffer_ */
+  size_t fill_{0};
+  File vfd_{-1};
+  size_t position_{0};
+};
+
+/* nullptr if segment file is already local */
+static std::unique_ptr<SegmentLoad> segmentLoad(Relation aorel,
+                                                Oid loadSpcOid,
+                                                Oid orig_relnode, int segno,
+                                                const char *dest_path) {
   const auto rnode = YezzeyGetRelFileLocator(aorel);
 
   const auto coords = relnodeCoord(
@@ -266,10 +735,112 @@ void loadRelationSegment(Relation aorel, Oid loadSpcOid, Oid orig_relnode,
 
   elog(yezzey_ao_log_level, "contructed path %s", path.c_str());
   if (ensureFilepathLocal(path)) {
+    return nullptr;
+  }
+
+  return make_unique<SegmentLoad>(aorel, nspname, relname, segno, coords,
+                                  path);
+}
+
+void loadRelationSegment(Relation aorel, Oid loadSpcOid, Oid orig_relnode,
+                         int segno, const char *dest_path) {
+  auto load = segmentLoad(aorel, loadSpcOid, orig_relnode, segno, dest_path);
+  if (load == nullptr) {
+    return;
+  }
+
+  load->start();
+  while (!load->finished()) {
+    load->step(true);
+  }
+  load->finish();
+}
+
+void loadRelationSegments(Relation aorel, Oid loadSpcOid, Oid orig_relnode,
+                          const int *segnos, int nsegnos,
+                          const char *dest_path) {
+  /*
+   * Multiplexed streams share one socket, and chunk pool may wait for
+   * other backends loading the same extent: neither can be polled per
+   * segment file.
+   */
+  if (yezzey_load_parallel > 1 &&
+      (yezzey_yproxy_multiplex || ChunkPool::enabled())) {
+    elog(WARNING, "yezzey: yezzey.load_parallel is ignored with %s, loading "
+                  "segment files one by one",
+         yezzey_yproxy_multiplex ? "yezzey.yproxy_multiplex"
+                                 : "yezzey.chunk_pool_size");
+  }
+
+  if (yezzey_load_parallel <= 1 || yezzey_yproxy_multiplex ||
+      ChunkPool::enabled()) {
+    for (int i = 0; i < nsegnos; ++i) {
+      loadRelationSegment(aorel, loadSpcOid, orig_relnode, segnos[i],
+                          dest_path);
+    }
     return;
   }
 
-  loadSegmentFromExternalStorage(aorel, nspname, relname, segno, coords, path);
+  std::vector<std::unique_ptr<SegmentLoad>> active;
+  int next = 0;
+
+  while (next < nsegnos || !active.empty()) {
+    CHECK_FOR_INTERRUPTS();
+
+    while (next < nsegnos && active.size() < (size_t)yezzey_load_parallel) {
+      auto load = segmentLoad(aorel, loadSpcOid, orig_relnode, segnos[next++],
+                              dest_path);
+      if (load != nullptr) {
+        load->start();
+        active.push_back(std::move(load));
+      }
+    }
+
+    /* wait until some yproxy socket has data */
+    std::vector<struct pollfd> pfds;
+    std::vector<size_t> polled;
+    for (size_t i = 0; i < active.size(); ++i) {
+      auto &load = *active[i];
+      if (load.finished()) {
+        continue;
+      }
+
+      const auto fd = load.pollFd();
+      if (fd == -1) {
+        /* data is local or transport can not be polled, read in place */
+        load.step(false);
+        continue;
+      }
+
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      pfds.push_back(pfd);
+      polled.push_back(i);
+    }
+
+    if (!pfds.empty()) {
+      const auto rc = poll(pfds.data(), pfds.size(), 1000);
+      if (rc < 0 && errno != EINTR) {
+        elog(ERROR, "yezzey: failed to poll yproxy connections: %m");
+      }
+      for (size_t j = 0; rc > 0 && j < pfds.size(); ++j) {
+        if (pfds[j].revents != 0) {
+          active[polled[j]]->step(false);
+        }
+      }
+    }
+
+    for (auto it = active.begin(); it != active.end();) {
+      if ((*it)->finished()) {
+        (*it)->finish();
+        it = active.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
 }
 
 int removeLocalFile(const char *localPath) {
@@ -294,9 +865,7 @@ std::string getlocalpath(const relnodeCoord &coords) {
   return getlocalpath(local_path, coords.blkno);
 }
 
-void offloadRelationSegment(Relation aorel, int segno, int64 modcount,
-                            int64 logicalEof,
-                            const char *external_storage_path) {
+static std::shared_ptr<IOadv> segmentIOadv(Relation aorel, int segno) {
   const auto rnode = YezzeyGetRelFileLocator(aorel);
 
   const auto coords =
@@ -317,13 +886,19 @@ void offloadRelationSegment(Relation aorel, int segno, int64 modcount,
   const auto nsptup = (Form_pg_namespace)GETSTRUCT(tp);
   const auto nspname = std::string(NameStr(nsptup->nspname));
   const auto relname = std::string(RelationGetRelationName(aorel));
-  const auto storage_path =
-      !external_storage_path ? "" : std::string(external_storage_path);
   ReleaseSysCache(tp);
 
-  const auto ioadv = std::make_shared<IOadv>(
+  return std::make_shared<IOadv>(
       nspname, relname, storage_class /* storage_class */, multipart_chunksize,
       coords, aorel->rd_id /* reloid */, use_gpg_crypto, yproxy_socket);
+}
+
+void offloadRelationSegment(Relation aorel, int segno, int64 modcount,
+                            int64 logicalEof,
+                            const char *external_storage_path) {
+  const auto storage_path =
+      !external_storage_path ? "" : std::string(external_storage_path);
+  const auto ioadv = segmentIOadv(aorel, segno);
 
   try {
     offloadRelationSegmentPath(aorel, ioadv, modcount, logicalEof,
@@ -350,7 +925,213 @@ void offloadRelationSegment(Relation aorel, int segno, int64 modcount,
   elog(NOTICE,
        "yezzey: relation segment reached external storage (blkno=%ld), up to "
        "logical eof %ld",
-       coords.blkno, logicalEof);
+       ioadv->coords_.blkno, logicalEof);
+}
+
+void offloadRelationSegments(Relation aorel,
+                             const std::vector<SegmentOffloadTask> &tasks,
+                             const char *external_storage_path) {
+  if (yezzey_offload_parallel <= 1) {
+    for (const auto &t : tasks) {
+      offloadRelationSegment(aorel, t.segno, t.modcount, t.logicalEof,
+                             external_storage_path);
+    }
+    return;
+  }
+
+  const auto storage_path =
+      !external_storage_path ? "" : std::string(external_storage_path);
+  std::vector<std::unique_ptr<SegmentOffload>> active;
+  size_t next = 0;
+
+  while (next < tasks.size() || !active.empty()) {
+    CHECK_FOR_INTERRUPTS();
+
+    while (next < tasks.size() &&
+           active.size() < (size_t)yezzey_offload_parallel) {
+      const auto &t = tasks[next++];
+      auto offload = make_unique<SegmentOffload>(
+          aorel, segmentIOadv(aorel, t.segno), t.modcount, t.logicalEof,
+          storage_path);
+      const auto rc = offload->start();
+      if (rc == -1) {
+        elog(ERROR, "yezzey: failed to start %s offloading",
+             offload->localPath().c_str());
+      }
+      if (rc == 1) {
+        active.push_back(std::move(offload));
+      }
+    }
+
+    /* read next pieces and wait until some yproxy socket can take data */
+    std::vector<struct pollfd> pfds;
+    std::vector<size_t> polled;
+    for (size_t i = 0; i < active.size(); ++i) {
+      auto &offload = *active[i];
+      if (!offload.finished()) {
+        if (offload.readChunk() < 0) {
+          elog(ERROR, "yezzey: failed to read %s",
+               offload.localPath().c_str());
+        }
+      }
+      if (!offload.pending()) {
+        continue;
+      }
+
+      const auto fd = offload.pollFd();
+      if (fd == -1) {
+        /* multiplexed or shared memory transport, send in place */
+        if (!offload.sendChunk()) {
+          elog(ERROR, "yezzey: failed to offload %s",
+               offload.localPath().c_str());
+        }
+        continue;
+      }
+
+      struct pollfd pfd;
+      pfd.fd = fd;
+      pfd.events = POLLOUT;
+      pfd.revents = 0;
+      pfds.push_back(pfd);
+      polled.push_back(i);
+    }
+
+    if (!pfds.empty()) {
+      const auto rc = poll(pfds.data(), pfds.size(), 1000);
+      if (rc < 0 && errno != EINTR) {
+        elog(ERROR, "yezzey: failed to poll yproxy connections: %m");
+      }
+      for (size_t j = 0; rc > 0 && j < pfds.size(); ++j) {
+        if (pfds[j].revents == 0) {
+          continue;
+        }
+        auto &offload = *active[polled[j]];
+        if (!offload.sendChunkNonBlocking()) {
+          elog(ERROR, "yezzey: failed to offload %s",
+               offload.localPath().c_str());
+        }
+      }
+    }
+
+    /* virtual index is updated by this backend, one segment at a time */
+    for (auto it = active.begin(); it != active.end();) {
+      if ((*it)->finished()) {
+        (*it)->finish();
+        it = active.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+}
+
+/*
+ * Merge run of adjacent chunks into one object and replace their virtual
+ * index rows with one spanning the whole run. Merged row keeps modcount of
+ * the last chunk of run, so virtual index order is not changed. Objects of
+ * merged chunks are not referenced any more and go to obsolete collection.
+ */
+static void compactChunkRun(Relation aorel, std::shared_ptr<IOadv> ioadv,
+                            const std::vector<ChunkInfo> &run) {
+  const auto &first = run.front();
+  const auto &last = run.back();
+  const int64 start = first.start_off;
+  const int64 finish = last.start_off + last.size;
+  const auto started_ms = nowMs();
+
+  YProxyReader reader(ioadv, GpIdentity.segindex, run);
+  reader.setIOClass(YezzeyIOClass::Background);
+
+  YIO merged(ioadv, GpIdentity.segindex, last.modcount, "");
+  YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
+
+  std::vector<char> buffer((size_t)yezzey_offload_transfer_size * 1024);
+  int64 progress = start;
+
+  while (!reader.empty()) {
+    CHECK_FOR_INTERRUPTS();
+    size_t amount = buffer.size();
+    if (!reader.read(buffer.data(), &amount)) {
+      break;
+    }
+    for (size_t tot = 0; tot < amount;) {
+      size_t curr = amount - tot;
+      if (!merged.io_write(buffer.data() + tot, &curr)) {
+        elog(ERROR, "yezzey: failed to write merged chunk of %s",
+             getlocalpath(ioadv->coords_).c_str());
+      }
+      tot += curr;
+    }
+    progress += amount;
+    YezzeyIOThrottle(YezzeyIOClass::Background, amount, 0);
+  }
+
+  if (progress != finish) {
+    elog(ERROR,
+         "yezzey: failed to read chunks of %s for compaction, got %ld of "
+         "%ld bytes",
+         getlocalpath(ioadv->coords_).c_str(), progress - start,
+         finish - start);
+  }
+  if (!merged.io_close()) {
+    elog(ERROR, "yezzey: failed to complete merged chunk of %s",
+         getlocalpath(ioadv->coords_).c_str());
+  }
+
+  /* merged object is durable, switch virtual index to it */
+  const auto yandexoid = YezzeyFindAuxIndex(aorel->rd_id);
+  YezzeyVirtualIndexDeleteChunks(yandexoid, ioadv->coords_.filenode,
+                                 ioadv->coords_.blkno, run);
+  YezzeyUpdateMetadataRelations(
+      yandexoid, ioadv->reloid, ioadv->coords_.filenode, ioadv->coords_.blkno,
+      start, finish, ioadv->use_gpg_crypto, merged.use_kek(),
+      0 /* reused */, last.modcount,
+      merged.writer_->getInsertionStorageLsn(),
+      merged.writer_->getExternalStoragePath().c_str(),
+      yezzey_fqrelname_md5(ioadv->nspname, ioadv->relname).c_str());
+
+  elog(yezzey_log_level,
+       "yezzey: merged %zu chunks of %s at [%ld, %ld) in %.0f ms", run.size(),
+       getlocalpath(ioadv->coords_).c_str(), start, finish,
+       nowMs() - started_ms);
+}
+
+int64 compactRelationSegments(Relation aorel,
+                              const std::vector<SegmentOffloadTask> &tasks) {
+  const uint64_t target = (uint64_t)yezzey_compaction_target_size * 1024 * 1024;
+  int64 compacted = 0;
+
+  for (const auto &t : tasks) {
+    CHECK_FOR_INTERRUPTS();
+
+    const auto ioadv = segmentIOadv(aorel, t.segno);
+    const auto order = YezzeyVirtualGetOrder(YezzeyFindAuxIndex(aorel->rd_id),
+                                             aorel->rd_id,
+                                             ioadv->coords_.filenode, t.segno);
+
+    for (size_t i = 0; i < order.size();) {
+      /* run of small chunks, each one starting where previous ends */
+      auto j = i;
+      uint64_t bytes = 0;
+      while (j < order.size() && order[j].size < target &&
+             bytes + order[j].size <= target &&
+             (j == i || order[j].start_off ==
+                            order[j - 1].start_off + order[j - 1].size)) {
+        bytes += order[j].size;
+        ++j;
+      }
+
+      if (j - i >= 2) {
+        compactChunkRun(aorel, ioadv,
+                        std::vector<ChunkInfo>(order.begin() + i,
+                                               order.begin() + j));
+        compacted += j - i;
+      }
+      i = std::max(j, i + 1);
+    }
+  }
+
+  return compacted;
 }
 
 Oid resolveTablespaceOidByName(const std::string &tablespacename) {
@@ -538,7 +1319,7 @@ int statRelationChunksSpaceUsage(Relation aorel, size_t *local_bytes,
   /* we dont need to interact with s3 while in recovery*/
 
 #ifdef USE_YPX_LISTER
-  auto lister = YProxyLister(ioadv, GpIdentity.segindex);
+  YProxyLister lister(ioadv, GpIdentity.segindex);
 #else
 #error "listing feature not supported"
 #endif
@@ -9,29 +9,31 @@
 
 #define MD5_HASH_LEN 32
 
-std::string yezzey_fqrelname_md5(const std::string &nspname,
-                                 const std::string &relname) {
+std::string yezzey_md5(const std::string &str) {
   char md[MD5_HASH_LEN + 1];
   md[MD5_HASH_LEN] = 0;
-  std::string full_name = nspname + "." + relname;
 
 #if PG_VERSION_NUM >= 150000
   /* ABI changed in b69aba7. */
   const char *errstr = NULL;
-  /* compute AO/AOCS relation name, just like WAL-G does*/
-  if (!pg_md5_hash(full_name.c_str(), full_name.size(), md, &errstr)) {
-    elog(ERROR, "failed to calculated RFQN md5 hash");
+  if (!pg_md5_hash(str.c_str(), str.size(), md, &errstr)) {
+    elog(ERROR, "failed to calculated md5 hash");
   }
 #else
-  /* compute AO/AOCS relation name, just like WAL-G does*/
-  if (!pg_md5_hash(full_name.c_str(), full_name.size(), md)) {
-    elog(ERROR, "failed to calculated RFQN md5 hash");
+  if (!pg_md5_hash(str.c_str(), str.size(), md)) {
+    elog(ERROR, "failed to calculated md5 hash");
   }
 #endif
 
   return std::string(md);
 }
 
+std::string yezzey_fqrelname_md5(const std::string &nspname,
+                                 const std::string &relname) {
+  /* compute AO/AOCS relation name, just like WAL-G does*/
+  return yezzey_md5(nspname + "." + relname);
+}
+
 /* creates yezzey xternal storage namespace prefix path */
 std::string yezzey_block_namespace_path(int32_t segid) {
   return "/segments_005/seg" + std::to_string(segid) + baseYezzeyPath;
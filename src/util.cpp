@@ -108,7 +108,7 @@ std::string make_yezzey_url(const std::string &prefix, int64_t modcount,
 int64_t yezzey_virtual_relation_size(std::shared_ptr<IOadv> adv,
                                      int32_t segid) {
   try {
-    auto lister = YProxyLister(adv, segid);
+    YProxyLister lister(adv, segid);
     int64_t sz = 0;
     auto chunks = lister.list_relation_chunks();
     for (auto chunk : chunks) {
@@ -142,7 +142,7 @@ int64_t yezzey_calc_virtual_relation_size(std::shared_ptr<IOadv> adv,
                                           const std::string &storage_path) {
 #if USE_WALG_BACKUPS
   try {
-    auto ioh = YIO(adv, segindx, modcount, storage_path);
+    YIO ioh(adv, segindx, modcount, storage_path);
     int64_t sz = 0;
     auto buf = std::vector<char>(1 << 20);
     /* fix this */
@@ -3,6 +3,7 @@
 #include "relfilelocator.h"
 #include "yezzey_heap_api.h"
 #include <algorithm>
+#include <unordered_map>
 
 #include "yezzey_meta.h"
 
@@ -127,6 +128,7 @@ yezzey_create_virtual_index_idx_internal(Oid relid, const std::string &relname,
   coloptions[1] = 0;
 
   classObjectId[2] = INT8_BTREE_OPS_OID;
+  coloptions[2] = 0;
 
 #if IsGreenplum6
   (void)index_create(yezzey_rel, relname.c_str(), relid, InvalidOid, InvalidOid,
@@ -252,6 +254,8 @@ Oid YezzeyFindAuxIndex_internal(Oid reloid) {
 Oid YezzeyFindAuxIndex(Oid reloid) { return YEZZEY_VIRTUAL_INDEX_RELATION; }
 
 void emptyYezzeyIndex(Oid yezzey_index_oid, Oid relfilenode) {
+  YezzeyVirtualIndexFlush();
+
   HeapTuple tuple;
   ScanKeyData skey[1];
 
@@ -283,6 +287,8 @@ void emptyYezzeyIndex(Oid yezzey_index_oid, Oid relfilenode) {
 
 void emptyYezzeyIndexBlkno(Oid yezzey_index_oid, Oid reloid /* not used */,
                            Oid relfilenode, int blkno) {
+  YezzeyVirtualIndexFlush();
+
   HeapTuple tuple;
   ScanKeyData skey[YezzeyVirtualIndexScanCols];
 
@@ -317,7 +323,61 @@ void emptyYezzeyIndexBlkno(Oid yezzey_index_oid, Oid reloid /* not used */,
   CommandCounterIncrement();
 } /* end emptyYezzeyIndexBlkno */
 
+void YezzeyVirtualIndexDeleteChunks(Oid yezzey_index_oid, Oid relfilenode,
+                                    int blkno,
+                                    const std::vector<ChunkInfo> &chunks) {
+  YezzeyVirtualIndexFlush();
+
+  HeapTuple tuple;
+  ScanKeyData skey[YezzeyVirtualIndexScanCols];
+  size_t deleted = 0;
+
+  auto rel = heap_open(yezzey_index_oid, RowExclusiveLock);
+
+  auto snap = RegisterSnapshot(GetTransactionSnapshot());
+
+  ScanKeyInit(&skey[0], Anum_yezzey_virtual_index_filenode,
+              BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relfilenode));
+
+  ScanKeyInit(&skey[1], Anum_yezzey_virtual_index_blkno, BTEqualStrategyNumber,
+              F_INT4EQ, Int32GetDatum(blkno));
+
+  auto desc = yezzey_beginscan(rel, snap, YezzeyVirtualIndexScanCols, skey);
+
+  while (HeapTupleIsValid(tuple = heap_getnext(desc, ForwardScanDirection))) {
+    auto ytup = (Form_yezzey_virtual_index)GETSTRUCT(tuple);
+
+    /* row is the one chunk was read from, its path is not compared */
+    for (const auto &c : chunks) {
+      if (c.modcount == ytup->modcount && c.lsn == ytup->lsn &&
+          c.start_off == (uint64_t)ytup->start_offset &&
+          c.start_off + c.size == (uint64_t)ytup->finish_offset) {
+        simple_heap_delete(rel, &tuple->t_self);
+        ++deleted;
+        break;
+      }
+    }
+  }
+
+  yezzey_endscan(desc);
+  heap_close(rel, RowExclusiveLock);
+
+  UnregisterSnapshot(snap);
+
+  if (deleted != chunks.size()) {
+    elog(ERROR,
+         "yezzey: virtual index of relfilenode %u blkno %d changed "
+         "concurrently, %zu of %zu chunks found",
+         relfilenode, blkno, deleted, chunks.size());
+  }
+
+  /* make changes visible*/
+  CommandCounterIncrement();
+} /* end YezzeyVirtualIndexDeleteChunks */
+
 void YezzeyFixupVirtualIndex_internal(Oid yezzey_index_oid, Relation relation) {
+  YezzeyVirtualIndexFlush();
+
 
   HeapTuple tuple;
   ScanKeyData skey[1];
@@ -375,12 +435,30 @@ void YezzeyFixupVirtualIndex(Relation relation) {
       YezzeyFindAuxIndex(RelationGetRelid(relation)), relation);
 } /* end YezzeyFixupVirtualIndex */
 
-void YezzeyVirtualIndexInsert(Oid yandexoid /*yezzey auxiliary index oid*/,
-                              Oid reloid, Oid relfilenodeOid, int64_t blkno,
-                              int64_t offset_start, int64_t offset_finish,
-                              int32_t encrypted, int32_t reused,
-                              int64_t modcount, XLogRecPtr lsn,
-                              const char *x_path /* external path */) {
+/* virtual index row waiting for flush */
+struct PendingVirtualIndexRow {
+  Oid yandexoid;
+  Oid reloid;
+  Oid relfilenode;
+  int64_t blkno;
+  int64_t offset_start;
+  int64_t offset_finish;
+  int32_t encrypted;
+  int32_t reused;
+  int64_t modcount;
+  XLogRecPtr lsn;
+  std::string x_path;
+};
+
+/*
+ * Rows inserted by top-level transaction, flushed in one go at the end of
+ * statement, before commit and before virtual index is read or modified
+ * by this backend.
+ */
+static std::vector<PendingVirtualIndexRow> pending_rows;
+
+static HeapTuple formVirtualIndexTuple(Relation yandxrel,
+                                       const PendingVirtualIndexRow &row) {
   bool nulls[Natts_yezzey_virtual_index];
   Datum values[Natts_yezzey_virtual_index];
 
@@ -390,76 +468,216 @@ void YezzeyVirtualIndexInsert(Oid yandexoid /*yezzey auxiliary index oid*/,
   /* INSERT INTO  yezzey.yezzey_virtual_index_<oid> VALUES(segno, start_offset,
    * 0, modcount, external_path) */
 
-  auto yandxrel = heap_open(yandexoid, RowExclusiveLock);
-
-  values[Anum_yezzey_virtual_index_reloid - 1] = Int64GetDatum(reloid);
+  values[Anum_yezzey_virtual_index_reloid - 1] = Int64GetDatum(row.reloid);
   values[Anum_yezzey_virtual_index_filenode - 1] =
-      ObjectIdGetDatum(relfilenodeOid);
+      ObjectIdGetDatum(row.relfilenode);
 
-  values[Anum_yezzey_virtual_index_blkno - 1] = Int64GetDatum(blkno);
+  values[Anum_yezzey_virtual_index_blkno - 1] = Int64GetDatum(row.blkno);
 
-  values[Anum_yezzey_virtual_start_off - 1] = Int64GetDatum(offset_start);
-  values[Anum_yezzey_virtual_finish_off - 1] = Int64GetDatum(offset_finish);
+  values[Anum_yezzey_virtual_start_off - 1] = Int64GetDatum(row.offset_start);
+  values[Anum_yezzey_virtual_finish_off - 1] = Int64GetDatum(row.offset_finish);
 
-  values[Anum_yezzey_virtual_encrypted - 1] = Int32GetDatum(encrypted);
-  values[Anum_yezzey_virtual_reused_from_backup - 1] = Int32GetDatum(reused);
+  values[Anum_yezzey_virtual_encrypted - 1] = Int32GetDatum(row.encrypted);
+  values[Anum_yezzey_virtual_reused_from_backup - 1] =
+      Int32GetDatum(row.reused);
 
-  values[Anum_yezzey_virtual_modcount - 1] = Int64GetDatum(modcount);
-  values[Anum_yezzey_virtual_lsn - 1] = LSNGetDatum(lsn);
+  values[Anum_yezzey_virtual_modcount - 1] = Int64GetDatum(row.modcount);
+  values[Anum_yezzey_virtual_lsn - 1] = LSNGetDatum(row.lsn);
   values[Anum_yezzey_virtual_x_path - 1] =
-      PointerGetDatum(cstring_to_text(x_path));
+      PointerGetDatum(cstring_to_text(row.x_path.c_str()));
+
+  return heap_form_tuple(RelationGetDescr(yandxrel), values, nulls);
+}
+
+void YezzeyVirtualIndexFlush() {
+  if (pending_rows.empty()) {
+    return;
+  }
 
-  auto yandxtuple = heap_form_tuple(RelationGetDescr(yandxrel), values, nulls);
+  std::vector<PendingVirtualIndexRow> rows;
+  rows.swap(pending_rows);
 
-  /* send tuple messages to master */
+  /* heap and its indexes are opened once per batch */
+  size_t i = 0;
+  while (i < rows.size()) {
+    const auto yandexoid = rows[i].yandexoid;
+    auto yandxrel = heap_open(yandexoid, RowExclusiveLock);
+    auto indstate = CatalogOpenIndexes(yandxrel);
 
+    for (; i < rows.size() && rows[i].yandexoid == yandexoid; ++i) {
+      auto yandxtuple = formVirtualIndexTuple(yandxrel, rows[i]);
 #if IsModernYezzey
+      CatalogTupleInsertWithInfo(yandxrel, yandxtuple, indstate);
+#else
+      /* if gp6 insert tuples locally */
+      simple_heap_insert(yandxrel, yandxtuple);
+      CatalogIndexInsert(indstate, yandxtuple);
+#endif
+      heap_freetuple(yandxtuple);
+    }
 
-#if 0 /* Yezzey 3 */
-  auto mt_bind = create_memtuple_binding(
-      RelationGetDescr(yandxrel), RelationGetNumberOfAttributes(yandxrel));
+    CatalogCloseIndexes(indstate);
+    heap_close(yandxrel, RowExclusiveLock);
+  }
 
-  auto memtup = memtuple_form(mt_bind, values, nulls);
+  CommandCounterIncrement();
+}
+
+void YezzeyVirtualIndexXactCallback(XactEvent event, void *arg) {
+  switch (event) {
+  case XACT_EVENT_PRE_COMMIT:
+  case XACT_EVENT_PRE_PREPARE:
+    YezzeyVirtualIndexFlush();
+    break;
+  case XACT_EVENT_ABORT:
+    pending_rows.clear();
+    break;
+  default:
+    break;
+  }
+}
+
+void YezzeyVirtualIndexInsert(Oid yandexoid /*yezzey auxiliary index oid*/,
+                              Oid reloid, Oid relfilenodeOid, int64_t blkno,
+                              int64_t offset_start, int64_t offset_finish,
+                              int32_t encrypted, int32_t reused,
+                              int64_t modcount, XLogRecPtr lsn,
+                              const char *x_path /* external path */) {
+  pending_rows.push_back(PendingVirtualIndexRow{
+      yandexoid, reloid, relfilenodeOid, blkno, offset_start, offset_finish,
+      encrypted, reused, modcount, lsn, std::string(x_path)});
 
   /*
-   * get space to insert our next item (tuple)
+   * Queued rows are inserted by whichever subtransaction flushes them, so
+   * rows of subtransaction go right away and its abort takes them back.
+   * Statements flush at their end, so subtransaction does not start with
+   * rows of its parent queued.
    */
-  auto itemLen = memtuple_get_size(memtup);
+  if (IsSubTransaction()) {
+    YezzeyVirtualIndexFlush();
+  }
+}
 
-  StringInfoData buf;
+/* chunks of one segment file */
+struct CachedOrder {
+  bool ordered{false};
+  std::vector<ChunkInfo> chunks;
+};
+
+/*
+ * Chunk orders of segment files read by this backend. Orders of all segment
+ * files of a relfilenode are loaded by one scan, so opening every column of
+ * wide AOCS relation does not scan the virtual index again. Cache is valid
+ * while the same snapshot would be used for the scan: within a statement
+ * (within a transaction for snapshot isolation levels) and until command
+ * counter moves, which virtual index modifications make it do.
+ */
+struct VirtualOrderCache {
+  TimestampTz xact_start{0};
+  TimestampTz stmt_start{0};
+  CommandId cid{InvalidCommandId};
+  /* relfilenode -> blkno -> chunks, ordered on first use */
+  std::unordered_map<Oid, std::unordered_map<int, CachedOrder>> orders;
+};
+
+static VirtualOrderCache order_cache;
+
+static void validateOrderCache() {
+  const auto xact_start = GetCurrentTransactionStartTimestamp();
+  const auto stmt_start =
+      IsolationUsesXactSnapshot() ? 0 : GetCurrentStatementStartTimestamp();
+  const auto cid = GetCurrentCommandId(false);
+
+  if (order_cache.xact_start != xact_start ||
+      order_cache.stmt_start != stmt_start || order_cache.cid != cid) {
+    order_cache.orders.clear();
+    order_cache.xact_start = xact_start;
+    order_cache.stmt_start = stmt_start;
+    order_cache.cid = cid;
+  }
+}
 
-  pq_beginmessage(&buf, 'z');
-  pq_sendint(&buf, itemLen, sizeof(itemLen));
-  pq_sendbytes(&buf, (const char *)memtup, itemLen);
-  pq_endmessage(&buf);
+/* sort chunks of segment file by modcount and drop duplicates */
+static std::vector<ChunkInfo> orderChunks(std::vector<ChunkInfo> &res) {
+  const auto less = [](const ChunkInfo &lhs, const ChunkInfo &rhs) {
+    return lhs.modcount == rhs.modcount ? lhs.lsn < rhs.lsn
+                                        : lhs.modcount < rhs.modcount;
+  };
 
-#else
-  CatalogTupleInsert(yandxrel, yandxtuple);
-#endif
-#else
-  /* if gp6 insert tuples locally */
-  simple_heap_insert(yandxrel, yandxtuple);
-  CatalogUpdateIndexes(yandxrel, yandxtuple);
-#endif
+  /* sort by modcount - they are unic. Index scan returns them sorted. */
+  if (!std::is_sorted(res.begin(), res.end(), less)) {
+    std::sort(res.begin(), res.end(), less);
+  }
 
-  heap_freetuple(yandxtuple);
-  heap_close(yandxrel, RowExclusiveLock);
+  std::vector<ChunkInfo> modcnt_uniqres;
 
-  CommandCounterIncrement();
+  /* remove duplicated data chunks while read.
+   * report correuption in case of offset mismatch.
+   */
+
+  for (uint i = 0; i < res.size(); ++i) {
+    if (res[i].size == 0) {
+      continue;
+    }
+    if (i + 1 < res.size() && res[i + 1].modcount == res[i].modcount) {
+      if (res[i + 1].start_off != res[i].start_off) {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg_internal("found duplicated modcount data chunk with "
+                                 "diffferent offsets: %lu vs %lu",
+                                 res[i].start_off, res[i + 1].start_off)));
+      } else {
+        ereport(NOTICE, (errcode(ERRCODE_DATA_CORRUPTED),
+                         errmsg_internal(
+                             "found duplicated modcount data chunk, skip")));
+      }
+      continue;
+    }
+    modcnt_uniqres.push_back(res[i]);
+  }
+
+  return modcnt_uniqres;
+}
+
+/*
+ * Segment file chunks are ordered lazily, so that corruption of one segment
+ * file is reported only when it is read.
+ */
+static std::vector<ChunkInfo>
+cachedOrder(std::unordered_map<int, CachedOrder> &orders, int blkno) {
+  auto it = orders.find(blkno);
+  if (it == orders.end()) {
+    return std::vector<ChunkInfo>();
+  }
+  if (!it->second.ordered) {
+    it->second.chunks = orderChunks(it->second.chunks);
+    it->second.ordered = true;
+  }
+  return it->second.chunks;
 }
 
 std::vector<ChunkInfo>
 YezzeyVirtualGetOrder(Oid yandexoid /*yezzey auxiliary index oid*/,
                       Oid reloid /* not used */, Oid relfilenode, int blkno) {
+  /* rows of this transaction must be visible */
+  YezzeyVirtualIndexFlush();
+  validateOrderCache();
+
+  auto cached = order_cache.orders.find(relfilenode);
+  if (cached != order_cache.orders.end()) {
+    return cachedOrder(cached->second, blkno);
+  }
+
   /* SELECT external_path
    * FROM yezzey.yezzey_virtual_index_<oid>
-   * WHERE segno = .. and filenode = ..
+   * WHERE filenode = ..
    * <>; */
   HeapTuple tuple;
 
-  ScanKeyData skey[YezzeyVirtualIndexScanCols];
+  ScanKeyData skey[1];
 
-  std::vector<ChunkInfo> res;
+  std::unordered_map<int, CachedOrder> res;
+  const auto paths = std::make_shared<ChunkPaths>();
 
   auto rel = heap_open(yandexoid, RowExclusiveLock);
 
@@ -469,12 +687,10 @@ YezzeyVirtualGetOrder(Oid yandexoid /*yezzey auxiliary index oid*/,
   // BTEqualStrategyNumber,
   //             F_OIDEQ, ObjectIdGetDatum(reloid));
 
+  /* all segment files at once, index prefix on filenode is used */
   ScanKeyInit(&skey[0], Anum_yezzey_virtual_index_filenode,
               BTEqualStrategyNumber, F_OIDEQ, ObjectIdGetDatum(relfilenode));
 
-  ScanKeyInit(&skey[1], Anum_yezzey_virtual_index_blkno, BTEqualStrategyNumber,
-              F_INT4EQ, Int32GetDatum(blkno));
-
   auto use_y_index = false;
 
   {
@@ -489,7 +705,7 @@ YezzeyVirtualGetOrder(Oid yandexoid /*yezzey auxiliary index oid*/,
 
   /* TBD: Read index */
   auto desc = yezzey_systable_beginscan(rel, YEZZEY_VIRTUAL_INDEX_IDX_RELATION,
-                                        use_y_index, snap, 2, skey);
+                                        use_y_index, snap, 1, skey);
 
   while (HeapTupleIsValid(tuple = yezzey_systable_getnext(desc))) {
     auto ytup = ((FormData_yezzey_virtual_index *)GETSTRUCT(tuple));
@@ -497,10 +713,18 @@ YezzeyVirtualGetOrder(Oid yandexoid /*yezzey auxiliary index oid*/,
     auto flags = ytup->encrypted;
     bool encrypted = flags & YEZZEY_IS_ENC;
     bool kek = flags & YEZZEY_ENC_KEK;
-    res.push_back(ChunkInfo(ytup->lsn, ytup->modcount,
-                            text_to_cstring(&ytup->x_path),
-                            ytup->finish_offset - ytup->start_offset,
-                            ytup->start_offset, encrypted, kek));
+    /* intern path straight from the tuple, without palloc'ed cstring */
+    auto x_path = pg_detoast_datum_packed((struct varlena *)&ytup->x_path);
+    const auto path_id =
+        paths->intern(VARDATA_ANY(x_path), VARSIZE_ANY_EXHDR(x_path),
+                      ytup->modcount, ytup->lsn);
+    res[ytup->blkno].chunks.push_back(
+        ChunkInfo(ytup->lsn, ytup->modcount, paths, path_id,
+                  ytup->finish_offset - ytup->start_offset,
+                  ytup->start_offset, encrypted, kek));
+    if ((Pointer)x_path != (Pointer)&ytup->x_path) {
+      pfree(x_path);
+    }
   }
 
   yezzey_systable_endscan(desc);
@@ -510,40 +734,10 @@ YezzeyVirtualGetOrder(Oid yandexoid /*yezzey auxiliary index oid*/,
 
   /* make changes visible*/
   CommandCounterIncrement();
+  /* cache is keyed by command id as it is after the scan */
+  validateOrderCache();
 
-  /* sort by modcount - they are unic */
-  std::sort(res.begin(), res.end(),
-            [](const ChunkInfo &lhs, const ChunkInfo &rhs) {
-              return lhs.modcount == rhs.modcount ? lhs.lsn < rhs.lsn
-                                                  : lhs.modcount < rhs.modcount;
-            });
-
-  std::vector<ChunkInfo> modcnt_uniqres;
-
-  /* remove duplicated data chunks while read.
-   * report correuption in case of offset mismatch.
-   */
-
-  for (uint i = 0; i < res.size(); ++i) {
-    if (res[i].size == 0) {
-      continue;
-    }
-    if (i + 1 < res.size() && res[i + 1].modcount == res[i].modcount) {
-      if (res[i + 1].start_off != res[i].start_off) {
-        ereport(ERROR,
-                (errcode(ERRCODE_DATA_CORRUPTED),
-                 errmsg_internal("found duplicated modcount data chunk with "
-                                 "diffferent offsets: %lu vs %lu",
-                                 res[i].start_off, res[i + 1].start_off)));
-      } else {
-        ereport(NOTICE, (errcode(ERRCODE_DATA_CORRUPTED),
-                         errmsg_internal(
-                             "found duplicated modcount data chunk, skip")));
-      }
-      continue;
-    }
-    modcnt_uniqres.push_back(res[i]);
-  }
-
-  return modcnt_uniqres;
-}
\ No newline at end of file
+  auto &orders = order_cache.orders[relfilenode];
+  orders = std::move(res);
+  return cachedOrder(orders, blkno);
+}
@@ -0,0 +1,331 @@
+/*
+ *
+ * file: src/worker.cpp
+ */
+
+#include "worker.h"
+#include "gucs.h"
+#include "offload_policy.h"
+
+#include <algorithm>
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "pgtime.h"
+#include "postmaster/bgworker.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+}
+
+/* restart crashed worker after that many seconds */
+const int kAutoOffloadRestartSec = 60;
+
+/* offloaded relation chunks are merged at most that often */
+const pg_time_t kCompactionIntervalSec = 24 * 60 * 60;
+
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+static void autooffloadSighup(SIGNAL_ARGS) {
+  int save_errno = errno;
+  got_sighup = true;
+  SetLatch(&MyProc->procLatch);
+  errno = save_errno;
+}
+
+static void autooffloadSigterm(SIGNAL_ARGS) {
+  int save_errno = errno;
+  got_sigterm = true;
+  SetLatch(&MyProc->procLatch);
+  errno = save_errno;
+}
+
+void YezzeyAutoOffloadRegister(void) {
+  BackgroundWorker worker;
+
+  memset(&worker, 0, sizeof(worker));
+  worker.bgw_flags =
+      BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+  worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+  worker.bgw_restart_time = kAutoOffloadRestartSec;
+  snprintf(worker.bgw_name, BGW_MAXLEN, "yezzey auto-offload worker");
+  snprintf(worker.bgw_library_name, BGW_MAXLEN, "yezzey");
+  snprintf(worker.bgw_function_name, BGW_MAXLEN, "yezzey_autooffload_main");
+
+  RegisterBackgroundWorker(&worker);
+}
+
+/* hour of day is in [window_start, window_end), window may wrap midnight */
+static bool inOffloadWindow() {
+  const auto start = yezzey_autooffload_window_start;
+  const auto end = yezzey_autooffload_window_end;
+  if (start == end || (start == 0 && end == 24)) {
+    return true;
+  }
+
+  const pg_time_t now = (pg_time_t)time(NULL);
+  const auto hour = pg_localtime(&now, session_timezone)->tm_hour;
+  if (start < end) {
+    return hour >= start && hour < end;
+  }
+  return hour >= start || hour < end;
+}
+
+/*
+ * Milliseconds until offload window closes, 0 if it never does. Used as
+ * statement_timeout of offloads, so that offload running when window
+ * closes is cancelled rather than left to run into business hours.
+ */
+static int64 offloadWindowLeftMs() {
+  const auto start = yezzey_autooffload_window_start;
+  const auto end = yezzey_autooffload_window_end;
+  if (start == end || (start == 0 && end == 24)) {
+    return 0;
+  }
+
+  const pg_time_t now = (pg_time_t)time(NULL);
+  const auto tm = pg_localtime(&now, session_timezone);
+  const int64 sec = tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+  int64 left = end * 3600 - sec;
+  if (left <= 0) {
+    /* window wraps midnight, we are before it */
+    left += 24 * 3600;
+  }
+  return left * 1000;
+}
+
+/* SET LOCAL statement_timeout bounding command by offload window */
+static std::string offloadWindowSettings() {
+  const auto left_ms = offloadWindowLeftMs();
+  if (left_ms == 0) {
+    return "";
+  }
+  return "SET LOCAL statement_timeout = " +
+         std::to_string(std::min<int64>(left_ms, INT_MAX));
+}
+
+/*
+ * Run query returning relation oids in its own transaction.
+ */
+static std::vector<Oid> selectRelations(const char *query) {
+  std::vector<Oid> reloids;
+  auto oldcontext = CurrentMemoryContext;
+
+  StartTransactionCommand();
+  PG_TRY();
+  {
+    SPI_connect();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, query);
+
+    if (SPI_execute(query, true, 0) != SPI_OK_SELECT) {
+      elog(ERROR, "yezzey: auto-offload query failed: %s", query);
+    }
+
+    for (uint64 i = 0; i < SPI_processed; ++i) {
+      bool isnull;
+      const auto d = SPI_getbinval(SPI_tuptable->vals[i],
+                                   SPI_tuptable->tupdesc, 1, &isnull);
+      if (!isnull) {
+        reloids.push_back(DatumGetObjectId(d));
+      }
+    }
+
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+  }
+  PG_CATCH();
+  {
+    /* e.g. yezzey schema is missing; try again next round */
+    MemoryContextSwitchTo(oldcontext);
+    EmitErrorReport();
+    FlushErrorState();
+    AbortCurrentTransaction();
+    reloids.clear();
+  }
+  PG_END_TRY();
+
+  pgstat_report_activity(STATE_IDLE, NULL);
+  return reloids;
+}
+
+/*
+ * Run per-relation command in its own transaction, after settings (SET
+ * LOCAL commands) if they are not empty. Failure is reported and does not
+ * stop processing of other relations.
+ */
+static bool runForRelation(Oid reloid, const char *query,
+                           const char *settings) {
+  Oid argtypes[1] = {OIDOID};
+  Datum values[1] = {ObjectIdGetDatum(reloid)};
+  bool ok = true;
+  auto oldcontext = CurrentMemoryContext;
+
+  StartTransactionCommand();
+  PG_TRY();
+  {
+    SPI_connect();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, query);
+
+    if (settings != NULL && settings[0] != '\0' &&
+        SPI_execute(settings, false, 0) != SPI_OK_UTILITY) {
+      elog(ERROR, "yezzey: failed to apply auto-offload settings");
+    }
+    if (SPI_execute_with_args(query, 1, argtypes, values, NULL, false, 0) !=
+        SPI_OK_SELECT) {
+      elog(ERROR, "yezzey: auto-offload query failed: %s", query);
+    }
+
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+  }
+  PG_CATCH();
+  {
+    MemoryContextSwitchTo(oldcontext);
+    EmitErrorReport();
+    FlushErrorState();
+    AbortCurrentTransaction();
+    ok = false;
+  }
+  PG_END_TRY();
+
+  pgstat_report_activity(STATE_IDLE, NULL);
+  return ok;
+}
+
+/*
+ * Offload relations listed in yezzey.auto_offload_relations whose expiry
+ * date has passed, at most yezzey.autooffload_max_relations per round.
+ * Offload sets rellast_archived of relation in yezzey.offload_metadata.
+ */
+void processOffloadedRelations() {
+  const auto query =
+      "SELECT a.reloid FROM yezzey.auto_offload_relations a "
+      "JOIN pg_catalog.pg_class c ON c.oid = a.reloid "
+      "WHERE a.expire_date <= current_date "
+      "AND NOT EXISTS (SELECT 1 FROM yezzey.offload_metadata m "
+      "WHERE m.reloid = a.reloid AND m.relpolicy = 1) "
+      "ORDER BY a.expire_date LIMIT " +
+      std::to_string(yezzey_autooffload_max_relations);
+
+  for (const auto reloid : selectRelations(query.c_str())) {
+    if (got_sigterm || !inOffloadWindow()) {
+      return;
+    }
+
+    /* bandwidth is limited by yezzey.background_bandwidth_limit on segments */
+    auto settings = "SET LOCAL yezzey.offload_parallel = " +
+                    std::to_string(yezzey_autooffload_parallel);
+    const auto window = offloadWindowSettings();
+    if (!window.empty()) {
+      settings += "; " + window;
+    }
+
+    elog(LOG, "yezzey: auto-offloading relation %u", reloid);
+    if (runForRelation(reloid,
+                       "SELECT yezzey_define_offload_policy(n.nspname, "
+                       "c.relname) FROM pg_catalog.pg_class c "
+                       "JOIN pg_catalog.pg_namespace n "
+                       "ON n.oid = c.relnamespace WHERE c.oid = $1",
+                       settings.c_str())) {
+      elog(LOG, "yezzey: auto-offloaded relation %u", reloid);
+    }
+  }
+}
+
+/*
+ * Merge small external storage chunks of offloaded relations, each one at
+ * most once per kCompactionIntervalSec. Compaction locks writers of
+ * relation out, so it is bound to offload window.
+ */
+void processCompaction() {
+  static std::unordered_map<Oid, pg_time_t> compacted;
+
+  const auto query = "SELECT reloid FROM yezzey.offload_metadata "
+                     "WHERE relpolicy = 1 ORDER BY rellast_archived";
+
+  for (const auto reloid : selectRelations(query)) {
+    if (got_sigterm || !inOffloadWindow()) {
+      return;
+    }
+    const auto now = (pg_time_t)time(NULL);
+    const auto it = compacted.find(reloid);
+    if (it != compacted.end() && now - it->second < kCompactionIntervalSec) {
+      continue;
+    }
+    if (runForRelation(reloid,
+                       "SELECT yezzey_compact_relation(n.nspname, "
+                       "c.relname) FROM pg_catalog.pg_class c "
+                       "JOIN pg_catalog.pg_namespace n "
+                       "ON n.oid = c.relnamespace WHERE c.oid = $1",
+                       offloadWindowSettings().c_str())) {
+      compacted[reloid] = now;
+    }
+  }
+}
+
+void yezzey_autooffload_main(Datum main_arg) {
+  pqsignal(SIGHUP, autooffloadSighup);
+  pqsignal(SIGTERM, autooffloadSigterm);
+  BackgroundWorkerUnblockSignals();
+
+  /*
+   * Offload functions are dispatched to segments from this process. Unlike
+   * a client backend, background worker gets no gp_role with its startup
+   * packet and is not a dispatcher, so functions it runs through SPI would
+   * stay on coordinator. Role must be set before the connection is
+   * initialized, as that sets dispatcher state up; diskquota worker does
+   * the same. Worker is registered on coordinator only.
+   */
+  Gp_role = GP_ROLE_DISPATCH;
+
+#if PG_VERSION_NUM >= 110000
+  BackgroundWorkerInitializeConnection(yezzey_autooffload_database, NULL, 0);
+#else
+  BackgroundWorkerInitializeConnection(yezzey_autooffload_database, NULL);
+#endif
+
+  elog(LOG, "yezzey: auto-offload worker started in database \"%s\"",
+       yezzey_autooffload_database);
+
+  while (!got_sigterm) {
+    if (inOffloadWindow()) {
+      processOffloadedRelations();
+    }
+    if (yezzey_autooffload_compact && inOffloadWindow()) {
+      processCompaction();
+    }
+
+#if PG_VERSION_NUM >= 100000
+    const auto rc = WaitLatch(&MyProc->procLatch,
+                              WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+                              yezzey_autooffload_naptime * 1000L,
+                              PG_WAIT_EXTENSION);
+#else
+    const auto rc = WaitLatch(&MyProc->procLatch,
+                              WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+                              yezzey_autooffload_naptime * 1000L);
+#endif
+    ResetLatch(&MyProc->procLatch);
+
+    if (rc & WL_POSTMASTER_DEATH) {
+      proc_exit(1);
+    }
+
+    CHECK_FOR_INTERRUPTS();
+
+    if (got_sighup) {
+      got_sighup = false;
+      ProcessConfigFile(PGC_SIGHUP);
+    }
+  }
+
+  proc_exit(0);
+}
@@ -3,7 +3,9 @@
  */
 
 #include "xvacuum.h"
+#include "chunk_cache.h"
 #include "gucs.h"
+#include "io_throttle.h"
 #include "offload_tablespace_map.h"
 #include "pg.h"
 #include "relfilelocator.h"
@@ -28,12 +30,15 @@ void yezzey_delete_chunk_internal(const char *external_chunk_path) {
 
     std::string storage_path(external_chunk_path);
 
+    YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
     auto deleter = std::make_shared<YProxyDeleter>(ioadv);
 
     if (!deleter->deleteChunk(storage_path)) {
       elog(ERROR, "failed to delete chunk at path %s", storage_path.c_str());
     }
 
+    ChunkDiskCache::evict(storage_path);
+
   } catch (...) {
     elog(ERROR, "failed to prepare x-storage reader for chunk");
   }
@@ -55,6 +60,7 @@ void yezzey_vacuum_garbage_internal(int segindx, bool confirm, bool crazyDrop) {
 
     std::string storage_path(yezzey_block_namespace_path(segindx));
 
+    YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
     auto deleter = std::make_shared<YProxyDeleter>(ioadv, ssize_t(segindx),
                                                    confirm, crazyDrop);
 
@@ -105,6 +111,8 @@ void yezzey_vacuum_garbage_relation_internal(Relation aorel, int segindx,
         yezzey_block_db_file_path(nspname, relname, coords, segindx));
     std::string storage_path_old(
         yezzey_block_db_file_path(nspname, relname, coords_old, segindx));
+    /* one delete request per storage path */
+    YezzeyIOThrottle(YezzeyIOClass::Background, 0, 2);
     {
       auto deleter = std::make_shared<YProxyDeleter>(ioadv, ssize_t(segindx),
                                                      confirm, crazyDrop);
@@ -143,6 +151,7 @@ void yezzey_delele_obsolete_internal(int segindx, bool crazy_drop,
 
     std::string storage_path(yezzey_block_db_path(nspoid, dboid, segindx));
 
+    YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
     auto deleter = std::make_shared<YProxyDeleterV2>(
         ioadv, ssize_t(segindx), std::string(dbname), crazy_drop);
 
@@ -166,6 +175,7 @@ void yezzey_collect_obsolete_internal(int segindx, const char *dbname,
 
     std::string storage_path(yezzey_block_db_path(nspoid, dboid, segindx));
 
+    YezzeyIOThrottle(YezzeyIOClass::Background, 0, 1);
     auto deleter = std::make_shared<YProxyDeleterV2>(ioadv, ssize_t(segindx),
                                                      std::string(dbname));
     // TODO get lock on smthng
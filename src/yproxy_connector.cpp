@@ -1,4 +1,61 @@
 #include "yproxy_connector.h"
+#include "gucs.h"
+#include "io_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <poll.h>
+
+/* idle connections kept by backend, per yproxy socket path */
+const size_t kMaxIdleConnections = 16;
+
+/* interrupts are checked at least that often while waiting for data */
+const int kWaitSliceMs = 100;
+
+static double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static std::vector<std::pair<std::string, int>> idle_connections;
+
+/*
+ * Take idle connection to yproxy, left by previous request which was
+ * completed with ReadyForQuery. Connections closed by yproxy meanwhile
+ * are readable (EOF) and get discarded.
+ */
+static int acquireIdleConnection(const std::string &socket_path) {
+  while (true) {
+    auto it = std::find_if(
+        idle_connections.rbegin(), idle_connections.rend(),
+        [&](const std::pair<std::string, int> &c) {
+          return c.first == socket_path;
+        });
+    if (it == idle_connections.rend()) {
+      return -1;
+    }
+    const auto fd = it->second;
+    idle_connections.erase(std::next(it).base());
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) == 0) {
+      return fd;
+    }
+    ::close(fd);
+  }
+}
+
+static void releaseIdleConnection(const std::string &socket_path, int fd) {
+  if (idle_connections.size() >= kMaxIdleConnections) {
+    ::close(idle_connections.front().second);
+    idle_connections.erase(idle_connections.begin());
+  }
+  idle_connections.emplace_back(socket_path, fd);
+}
 
 YProxyConnector::YProxyConnector(std::shared_ptr<IOadv> adv, ssize_t segindx)
     : adv_(adv), segindx_(segindx), client_fd_(-1) {}
@@ -6,17 +63,72 @@ YProxyConnector::YProxyConnector(std::shared_ptr<IOadv> adv, ssize_t segindx)
 YProxyConnector::~YProxyConnector() { close(); }
 bool YProxyConnector::close() {
   if (client_fd_ != -1) {
-    ::close(client_fd_);
+    /* yproxy keeps ring of the connection mapped, do not reuse it */
+    releaseConnection(client_fd_, reusable_ && ring_ == nullptr);
     client_fd_ = -1;
   }
+  ring_.reset();
+  reusable_ = false;
   return true;
 }
 
+/* yproxy refused the ring once, do not try again in this backend */
+static bool shm_ring_refused = false;
+
+bool YProxyConnector::useShmRing() {
+  return yezzey_yproxy_shm_ring_size > 0 && !shm_ring_refused &&
+         !yezzey_yproxy_multiplex;
+}
+
+/*
+ * Hand shared memory ring over to yproxy on client_fd_. If yproxy does not
+ * support it, reconnect and go on with plain socket transport.
+ */
+int YProxyConnector::setupShmRing() {
+  if (!useShmRing()) {
+    return 0;
+  }
+
+  ring_ = ShmRingTransport::negotiate(
+      client_fd_, (size_t)yezzey_yproxy_shm_ring_size * 1024 * 1024);
+  if (ring_ != nullptr) {
+    return 0;
+  }
+
+  elog(WARNING, "yezzey: yproxy refused shared memory ring, falling back "
+                "to socket transport");
+  shm_ring_refused = true;
+  ::close(client_fd_);
+  client_fd_ = connectYproxy();
+  return client_fd_ == -1 ? -1 : 0;
+}
+
+/* close connection, or keep it for next request if it is in idle state */
+void YProxyConnector::releaseConnection(int fd, bool reusable) {
+  if (reusable && yezzey_yproxy_keepalive) {
+    releaseIdleConnection(adv_->yproxy_socket, fd);
+    return;
+  }
+  ::close(fd);
+}
+
 int YProxyConnector::prepareYproxyConnection() {
+  client_fd_ = connectYproxy();
+  return client_fd_ == -1 ? -1 : 0;
+}
+
+int YProxyConnector::connectYproxy() {
+  if (yezzey_yproxy_keepalive) {
+    const auto fd = acquireIdleConnection(adv_->yproxy_socket);
+    if (fd != -1) {
+      return fd;
+    }
+  }
+
   // open unix data socket
 
-  client_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
-  if (client_fd_ == -1) {
+  const auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
     elog(WARNING, "failed to create unix socket, errno: %m");
     return -1;
   }
@@ -30,24 +142,29 @@ int YProxyConnector::prepareYproxyConnection() {
   strncpy(addr.sun_path, adv_->yproxy_socket.c_str(),
           sizeof(addr.sun_path) - 1);
 
-  const auto ret =
-      ::connect(client_fd_, (const struct sockaddr *)&addr, sizeof(addr));
+  const auto ret = ::connect(fd, (const struct sockaddr *)&addr, sizeof(addr));
 
   if (ret == -1) {
     elog(WARNING,
          "failed to acquire connection to unix socket on %s, errno: %m",
          adv_->yproxy_socket.c_str());
+    ::close(fd);
     return -1;
   }
-  return 0;
+  return fd;
 }
 
-int commonReadRFQResponce(int client_fd_) {
+int commonReadRFQResponce(int client_fd_, int timeout_ms) {
   const auto len = MSG_HEADER_SIZE;
   std::vector<char> buffer(len);
+  const auto readFull = [&](void *buf, size_t n) {
+    return timeout_ms > 0
+               ? commonReadFullTimeout(client_fd_, buf, n, timeout_ms)
+               : commonReadFull(client_fd_, buf, n);
+  };
   // try to read small number of bytes in one op
   // if failed, give up
-  const auto rc = commonReadFull(client_fd_, buffer.data(), len);
+  const auto rc = readFull(buffer.data(), len);
   if (rc != 0) {
     // handle
     return -1;
@@ -68,7 +185,7 @@ int commonReadRFQResponce(int client_fd_) {
   msgLen -= len;
 
   std::vector<char> data(msgLen);
-  const auto rc2 = commonReadFull(client_fd_, data.data(), msgLen);
+  const auto rc2 = readFull(data.data(), msgLen);
   if (rc2 != 0) {
     return -1;
   }
@@ -80,44 +197,58 @@ int commonReadRFQResponce(int client_fd_) {
 }
 
 int commonWriteFull(int client_fd_, const std::vector<char> &msg) {
-  auto len = msg.size();
-  size_t sync_offset = 0;
-  while (len > 0) {
+  return IOEngine::get().writeFull(client_fd_, msg.data(), msg.size());
+}
+
+int commonReadFull(int client_fd_, void *buf, size_t len) {
+  return IOEngine::get().readFull(client_fd_, buf, len);
+}
+
+int commonWaitReadable(int client_fd_, int timeout_ms) {
+  const auto started = nowMs();
+
+  while (true) {
     CHECK_FOR_INTERRUPTS();
-    const auto rc = ::write(client_fd_, msg.data() + sync_offset, len);
 
+    int wait = kWaitSliceMs;
+    if (timeout_ms > 0) {
+      const auto left = timeout_ms - (nowMs() - started);
+      if (left <= 0) {
+        return 0;
+      }
+      wait = std::min<int>(wait, left + 1);
+    }
+
+    struct pollfd pfd;
+    pfd.fd = client_fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    const auto rc = poll(&pfd, 1, wait);
     if (rc < 0) {
       if (errno == EINTR) {
         continue;
       }
       return -1;
     }
-    if (rc == 0) {
-      return -1;
+    if (rc > 0) {
+      return 1;
     }
-    len -= rc;
-    sync_offset += rc;
   }
-  return 0;
 }
 
-int commonReadFull(int client_fd_, void *buf, size_t len) {
+int commonReadFullTimeout(int client_fd_, void *buf, size_t len,
+                          int timeout_ms) {
   size_t offset = 0;
-  while (len > 0) {
-    CHECK_FOR_INTERRUPTS();
-    const auto rc = ::read(client_fd_, static_cast<char *>(buf) + offset, len);
-
-    if (rc < 0) {
-      if (errno == EINTR) {
-        continue;
-      }
-      return -1;
+  while (offset < len) {
+    const auto ready = commonWaitReadable(client_fd_, timeout_ms);
+    if (ready <= 0) {
+      return ready == 0 && offset == 0 ? 1 : -1;
     }
-    if (rc == 0) {
-      // EOF
+    const auto rc = IOEngine::get().read(
+        client_fd_, static_cast<char *>(buf) + offset, len - offset);
+    if (rc <= 0) {
       return -1;
     }
-    len -= rc;
     offset += rc;
   }
   return 0;
@@ -24,6 +24,7 @@ bool YProxyDeleterV2::Delete(const std::string &chunkName) {
   // TODO: split to chunks
   const auto msg = ConstructDeleteRequest(chunkName);
 
+  reusable_ = false;
   if (commonWriteFull(client_fd_, msg) == -1) {
     return false;
   }
@@ -32,6 +33,7 @@ bool YProxyDeleterV2::Delete(const std::string &chunkName) {
     return false;
   }
 
+  reusable_ = true;
   connGuard.dismiss();
   return true;
 }
@@ -48,6 +50,7 @@ bool YProxyDeleterV2::Collect(const std::string &chunkName) {
   // TODO: split to chunks
   const auto msg = ConstructCollectRequest(chunkName);
 
+  reusable_ = false;
   if (commonWriteFull(client_fd_, msg) == -1) {
     return false;
   }
@@ -57,6 +60,7 @@ bool YProxyDeleterV2::Collect(const std::string &chunkName) {
     return false;
   }
 
+  reusable_ = true;
   connGuard.dismiss();
   return true;
 }
@@ -45,6 +45,7 @@ std::vector<storageChunkMeta> YProxyLister::list_relation_chunks() {
       res.insert(res.end(), meta.begin(), meta.end());
       break;
     case MessageTypeReadyForQuery:
+      reusable_ = true;
       return res;
 
     default:
@@ -0,0 +1,165 @@
+#include "yproxy_mux.h"
+#include "gucs.h"
+
+/* messages queued for a stream nobody reads at the moment, at most */
+const size_t kMuxStreamQueueLimit = 16 * 1024 * 1024;
+
+static std::map<std::string, std::shared_ptr<YProxyMux>> mux_connections;
+
+YProxyMux::YProxyMux(std::shared_ptr<IOadv> adv) : YProxyConnector(adv, -1) {}
+
+YProxyMux::~YProxyMux() { close(); }
+
+std::shared_ptr<YProxyMux> YProxyMux::get(std::shared_ptr<IOadv> adv) {
+  auto &mux = mux_connections[adv->yproxy_socket];
+  if (mux == nullptr) {
+    mux = std::make_shared<YProxyMux>(adv);
+  }
+  return mux;
+}
+
+uint64_t YProxyMux::openStream() {
+  if (client_fd_ == -1) {
+    client_fd_ = connectYproxy();
+    if (client_fd_ == -1) {
+      return 0;
+    }
+  }
+
+  const auto stream = next_stream_++;
+  streams_[stream];
+  return stream;
+}
+
+void YProxyMux::closeStream(uint64_t stream) {
+  auto it = streams_.find(stream);
+  if (it == streams_.end()) {
+    return;
+  }
+  const auto cancelled = it->second.cancelled;
+  streams_.erase(it);
+
+  /*
+   * Owner may leave before the stream ended, e.g. on seek. Without close
+   * yproxy would keep streaming the rest of the object to us.
+   */
+  if (!cancelled &&
+      commonWriteFull(client_fd_, ConstructStreamClose(stream)) == -1) {
+    fail();
+  }
+}
+
+void YProxyMux::cancel(uint64_t stream, Stream &s) {
+  s.queue.clear();
+  s.queued = 0;
+  s.cancelled = true;
+  if (commonWriteFull(client_fd_, ConstructStreamClose(stream)) == -1) {
+    fail();
+  }
+}
+
+void YProxyMux::fail() {
+  elog(WARNING, "yezzey: multiplexed yproxy connection failed, %lu streams "
+                "aborted",
+       streams_.size());
+  YProxyConnector::close();
+  streams_.clear();
+}
+
+bool YProxyMux::send(uint64_t stream, const std::vector<char> &msg) {
+  auto it = streams_.find(stream);
+  if (it == streams_.end() || it->second.cancelled) {
+    return false;
+  }
+
+  if (commonWriteFull(client_fd_, ConstructStreamFrame(stream, msg)) == -1) {
+    fail();
+    return false;
+  }
+  return true;
+}
+
+bool YProxyMux::receive(uint64_t stream, std::vector<char> *msg) {
+  while (true) {
+    auto it = streams_.find(stream);
+    if (it == streams_.end() || it->second.cancelled) {
+      /* connection was lost, or stream cancelled */
+      return false;
+    }
+    auto &s = it->second;
+    if (!s.queue.empty()) {
+      *msg = std::move(s.queue.front());
+      s.queue.pop_front();
+      s.queued -= msg->size();
+      return true;
+    }
+    if (!readFrame(stream)) {
+      fail();
+      return false;
+    }
+  }
+}
+
+bool YProxyMux::readFrame(uint64_t waiting) {
+  std::vector<char> header(MSG_HEADER_SIZE);
+  const auto rc = commonReadFullTimeout(client_fd_, header.data(),
+                                        MSG_HEADER_SIZE, yezzey_read_timeout);
+  if (rc == 1) {
+    /* no frame started, connection is in sync, give up on this stream only */
+    elog(WARNING, "yezzey: no data for multiplexed stream %lu within %d ms",
+         waiting, yezzey_read_timeout);
+    cancel(waiting, streams_[waiting]);
+    return true;
+  }
+  if (rc != 0) {
+    return false;
+  }
+
+  uint64_t msgLen = 0;
+  for (size_t i = 0; i < MSG_HEADER_SIZE; i++) {
+    msgLen <<= 8;
+    msgLen += uint8_t(header[i]);
+  }
+  if (msgLen < MSG_HEADER_SIZE) {
+    // protocol violation
+    return false;
+  }
+
+  std::vector<char> body(msgLen - MSG_HEADER_SIZE);
+  if (commonReadFullTimeout(client_fd_, body.data(), body.size(),
+                            yezzey_read_timeout) != 0) {
+    /* timeout inside of frame leaves connection out of sync */
+    return false;
+  }
+
+  uint64_t stream;
+  size_t off;
+  if (!ParseStreamFrame(body, &stream, &off)) {
+    /* frame boundaries are intact, so only this message is lost */
+    elog(WARNING, "yezzey: unexpected message on multiplexed connection");
+    return true;
+  }
+
+  auto it = streams_.find(stream);
+  if (it == streams_.end() || it->second.cancelled) {
+    /* late message of closed stream */
+    return true;
+  }
+
+  auto &s = it->second;
+  s.queue.emplace_back(body.begin() + off + MSG_HEADER_SIZE, body.end());
+  s.queued += s.queue.back().size();
+  if (stream != waiting && s.queued > kMuxStreamQueueLimit) {
+    /*
+     * Owner does not keep up, and we cannot stop reading the socket
+     * without stalling the stream we wait for. Cancel the stream, its
+     * owner reissues request from where it stopped.
+     */
+    elog(yezzey_ao_log_level,
+         "yezzey: multiplexed stream %lu queued %lu bytes, cancelling it",
+         stream, s.queued);
+    cancel(stream, s);
+    return true;
+  }
+  return true;
+}
@@ -1,20 +1,112 @@
 #include "yproxy_reader.h"
+#include "chunk_pool.h"
+#include "gucs.h"
+#include "io_engine.h"
+#include "read_latency.h"
+
+#include <algorithm>
+#include <chrono>
+#include <poll.h>
 
 const int kDefaultRetryLimit = 100;
 
+/* reconnect backoff: 100ms doubling up to 10s, with full jitter */
+const uint64_t kBackoffBaseMs = 100;
+const uint64_t kBackoffCapMs = 10 * 1000;
+
+/* interrupts are checked at least that often while waiting for data */
+const int kPollSliceMs = 1000;
+
+/*
+ * ReadyForQuery follows chunk data right away. Keep-alive connection not
+ * completing request within that is closed rather than reused.
+ */
+const int kKeepaliveRFQTimeoutMs = 1000;
+
+/* no hedging until we know typical latency */
+const size_t kHedgeMinSamples = 20;
+const double kHedgeMinDelayMs = 10;
+
+/* time to first byte of chunk requests issued by this backend */
+static LatencyTracker chunk_latency;
+
+static double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
 YProxyReader::YProxyReader(std::shared_ptr<IOadv> adv, ssize_t segindx,
-                           const std::vector<ChunkInfo> order)
+                           const std::vector<ChunkInfo> order, int read_ahead)
     : YProxyConnector(adv, segindx), order_ptr_(0), order_(order),
       current_chunk_remaining_bytes_(0), current_retry(0),
-      retry_limit(kDefaultRetryLimit) {}
+      retry_limit(kDefaultRetryLimit), read_ahead_(read_ahead) {}
 
 YProxyReader::~YProxyReader() { close(); }
 
-bool YProxyReader::close() { return YProxyConnector::close(); }
+bool YProxyReader::close() {
+  dropReadAhead();
+  dropHedge();
+  cache_filler_.reset();
+  return closeChunkConnection();
+}
+
+/* close connection or multiplexed stream of current chunk */
+bool YProxyReader::closeChunkConnection() {
+  if (mux_stream_ != 0) {
+    mux_->closeStream(mux_stream_);
+    mux_stream_ = 0;
+  }
+  return YProxyConnector::close();
+}
+
+/* issue Cat request on backend-wide multiplexed connection */
+int YProxyReader::openMuxStream(const ChunkInfo &ci, size_t start_off) {
+  if (mux_ == nullptr) {
+    mux_ = YProxyMux::get(adv_);
+  }
+
+  mux_stream_ = mux_->openStream();
+  if (mux_stream_ == 0) {
+    return -1;
+  }
+  if (!mux_->send(mux_stream_, ConstructCatRequest(ci, start_off))) {
+    closeChunkConnection();
+    return -1;
+  }
+
+  mux_data_.clear();
+  mux_pos_ = 0;
+  return 0;
+}
+
+/* chunk data arrives as CopyData messages on multiplexed stream */
+ssize_t YProxyReader::readMuxStream(char *buffer, size_t amount) {
+  const size_t payload_off = PROTO_HEADER_SIZE + UINT64_SZ;
+
+  while (mux_pos_ == mux_data_.size()) {
+    std::vector<char> msg;
+    if (!mux_->receive(mux_stream_, &msg)) {
+      return -1;
+    }
+    if (msg.size() < payload_off || msg[0] != MessageTypeCopyData) {
+      /* stream ended before chunk data did */
+      return 0;
+    }
+    mux_data_ = std::move(msg);
+    mux_pos_ = payload_off;
+  }
+
+  const auto n = std::min(amount, mux_data_.size() - mux_pos_);
+  memcpy(buffer, mux_data_.data() + mux_pos_, n);
+  mux_pos_ += n;
+  return n;
+}
 
 std::vector<char> YProxyReader::ConstructCatRequest(const ChunkInfo &ci,
                                                     size_t start_off) {
 
+  const auto x_path = ci.x_path();
   const uint64_t settingsCnt = 1;
   const std::vector<std::pair<std::string, std::string>> settings = {
       {"TableSpace", adv_->tableSpace},
@@ -22,7 +114,7 @@ std::vector<char> YProxyReader::ConstructCatRequest(const ChunkInfo &ci,
 
   MsgBuilder builder = MsgBuilder()
                            .fieldProto()
-                           .fieldString(ci.x_path.size())
+                           .fieldString(x_path.size())
                            .fieldUInt64() // offset
                            .fieldUInt64();
 
@@ -35,7 +127,7 @@ std::vector<char> YProxyReader::ConstructCatRequest(const ChunkInfo &ci,
   builder
       .addProto(MessageTypeCatV2, ci.enc ? DecryptRequest : NoDecryptRequest,
                 ci.kek ? UseKEK : NoUseKEK)
-      .addString(ci.x_path)
+      .addString(x_path)
       .addUInt64(start_off)
       .addUInt64(settingsCnt);
 
@@ -46,31 +138,512 @@ std::vector<char> YProxyReader::ConstructCatRequest(const ChunkInfo &ci,
   return builder.get();
 }
 
-int YProxyReader::prepareYproxyConnection(const ChunkInfo &ci,
-                                          size_t start_off) {
-  const auto rb = YProxyConnector::prepareYproxyConnection();
-  if (rb != 0) {
-    return rb;
+int YProxyReader::issueCatRequest(const ChunkInfo &ci, size_t start_off) {
+  const auto fd = connectYproxy();
+  if (fd == -1) {
+    return -1;
   }
 
   const auto msg = ConstructCatRequest(ci, start_off);
 
-  if (commonWriteFull(client_fd_, msg) == -1) {
+  if (commonWriteFull(fd, msg) == -1) {
+    ::close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int YProxyReader::prepareYproxyConnection(const ChunkInfo &ci,
+                                          size_t start_off) {
+  YezzeyIOThrottle(io_class_, 0, 1);
+
+  /*
+   * Connection replaces whatever we read from, e.g. failed disk cache
+   * file. Its bytes are external storage traffic, and reconnection in the
+   * middle of chunk is not filled into the cache.
+   */
+  reading_cache_ = false;
+  cache_filler_.reset();
+
+  if (yezzey_yproxy_multiplex) {
+    return openMuxStream(ci, start_off);
+  }
+
+  if (useShmRing()) {
+    client_fd_ = connectYproxy();
+    if (client_fd_ == -1 || setupShmRing() != 0 ||
+        commonWriteFull(client_fd_, ConstructCatRequest(ci, start_off)) ==
+            -1) {
+      closeChunkConnection();
+      return -1;
+    }
+  } else {
+    client_fd_ = issueCatRequest(ci, start_off);
+  }
+  if (client_fd_ == -1) {
     return -1;
   }
 
-  /* reset retry count */
-  this->current_retry = 0;
+  awaiting_first_byte_ = true;
+  record_latency_ = true;
+  request_started_ms_ = nowMs();
 
   // now we are ready to read our request data
   return client_fd_;
 }
 
+/*
+ * Keep Cat requests for up to read_ahead_ following chunks in flight, so
+ * yproxy starts fetching them while the current chunk is being consumed.
+ * Failure here is not fatal: the chunk is requested again when reached.
+ */
+void YProxyReader::scheduleReadAhead() {
+  /*
+   * Multiplexed streams are demultiplexed in memory, read-ahead would
+   * buffer chunks. Shared memory ring is set up for on-demand connections
+   * only.
+   */
+  if (yezzey_yproxy_multiplex || useShmRing()) {
+    return;
+  }
+
+  auto next = order_ptr_ + 1;
+  if (!prefetched_.empty()) {
+    next = std::max(next, prefetched_.back().first + 1);
+  }
+
+  /* connect first, then send all Cat requests in one batch */
+  std::vector<std::pair<uint64_t, int>> issued;
+  std::vector<std::vector<char>> msgs;
+  for (; next < order_.size() && next <= order_ptr_ + read_ahead_; ++next) {
+    if (ChunkDiskCache::contains(order_[next])) {
+      /* will be read locally */
+      continue;
+    }
+    const auto fd = connectYproxy();
+    if (fd == -1) {
+      break;
+    }
+    issued.emplace_back(next, fd);
+    msgs.push_back(ConstructCatRequest(order_[next], 0));
+  }
+
+  std::vector<std::pair<int, const std::vector<char> *>> reqs;
+  for (size_t i = 0; i < issued.size(); ++i) {
+    reqs.emplace_back(issued[i].second, &msgs[i]);
+  }
+  YezzeyIOThrottle(io_class_, 0, issued.size());
+  const auto res = IOEngine::get().writeBatch(reqs);
+
+  for (size_t i = 0; i < issued.size(); ++i) {
+    if (res[i] != 0) {
+      elog(yezzey_ao_log_level, "failed to issue read-ahead for chunk %s",
+           order_[issued[i].first].x_path().c_str());
+      /* keep prefetched_ contiguous */
+      for (; i < issued.size(); ++i) {
+        ::close(issued[i].second);
+      }
+      return;
+    }
+    prefetched_.push_back(issued[i]);
+  }
+}
+
+void YProxyReader::dropReadAhead() {
+  for (const auto &p : prefetched_) {
+    ::close(p.second);
+  }
+  prefetched_.clear();
+}
+
+/*
+ * Open connection for the current chunk, starting at current_chunk_offset_.
+ * A read-ahead connection is reused if it was issued for the same position.
+ */
+int YProxyReader::openCurrentChunk() {
+  /* discard read-ahead connections we have skipped over */
+  while (!prefetched_.empty() && prefetched_.front().first < order_ptr_) {
+    ::close(prefetched_.front().second);
+    prefetched_.pop_front();
+  }
+
+  const auto &ci = order_[order_ptr_];
+  const auto cached_fd = ChunkDiskCache::open(ci, current_chunk_offset_);
+
+  if (!prefetched_.empty() && prefetched_.front().first == order_ptr_) {
+    const auto fd = prefetched_.front().second;
+    prefetched_.pop_front();
+    if (cached_fd == -1 && current_chunk_offset_ == 0) {
+      /* Cat request for this chunk is already in flight */
+      client_fd_ = fd;
+      /* issued long ago, so do not count it as latency sample */
+      awaiting_first_byte_ = true;
+      record_latency_ = false;
+      request_started_ms_ = nowMs();
+    } else {
+      ::close(fd);
+    }
+  }
+
+  reading_cache_ = cached_fd != -1;
+  if (cached_fd != -1) {
+    client_fd_ = cached_fd;
+    awaiting_first_byte_ = false;
+  } else if (client_fd_ == -1 && mux_stream_ == 0 &&
+             this->prepareYproxyConnection(ci, current_chunk_offset_) < 0) {
+    return -1;
+  }
+
+  /* only whole chunk, streamed from yproxy, may go into the cache */
+  if (cached_fd == -1 && current_chunk_offset_ == 0 &&
+      ChunkDiskCache::enabled(ci)) {
+    cache_filler_ = std::unique_ptr<ChunkCacheFiller>(new ChunkCacheFiller(ci));
+  }
+
+  scheduleReadAhead();
+  return client_fd_;
+}
+
+/*
+ * Position reader on virtual file offset. Chunks cover the virtual file
+ * as [start_off, start_off + size), so we find the chunk containing the
+ * offset and later issue Cat with the in-chunk offset, instead of
+ * streaming every chunk from the beginning of the file.
+ * No I/O is done here, the connection is opened lazily by read().
+ */
+bool YProxyReader::seek(int64_t offset) {
+  if (offset < 0) {
+    return false;
+  }
+  if (offset == tell()) {
+    return true;
+  }
+  if (offset >= extent_virt_off_ &&
+      offset < extent_virt_off_ + (int64_t)extent_len_) {
+    /* still within staged extent */
+    extent_pos_ = offset - extent_virt_off_;
+    return true;
+  }
+  extent_pos_ = extent_len_ = 0;
+
+  /* order_ is sorted by modcount, and so by start_off */
+  const auto it = std::upper_bound(
+      order_.begin(), order_.end(), offset,
+      [](int64_t off, const ChunkInfo &ci) {
+        return off < (int64_t)(ci.start_off + ci.size);
+      });
+
+  closeChunkConnection();
+  cache_filler_.reset();
+
+  order_ptr_ = it - order_.begin();
+  if (it == order_.end()) {
+    /* seek beyond last chunk, nothing to read */
+    current_chunk_offset_ = 0;
+    current_chunk_remaining_bytes_ = 0;
+    return true;
+  }
+
+  /*
+   * Chunks of a segment file cover it without gaps. Data at offset before
+   * the chunk is missing from virtual index, and reading from the chunk
+   * start would return bytes of other blocks as if they were requested.
+   */
+  if (offset < (int64_t)it->start_off) {
+    ereport(ERROR,
+            (errcode(ERRCODE_DATA_CORRUPTED),
+             errmsg_internal("yezzey: offset %ld of relfilenode %u segment "
+                             "file %ld is not covered by external storage "
+                             "chunks, next chunk %s starts at %lu",
+                             offset, adv_->coords_.filenode,
+                             adv_->coords_.blkno, it->x_path().c_str(),
+                             it->start_off)));
+  }
+  current_chunk_offset_ = offset - it->start_off;
+  current_chunk_remaining_bytes_ = it->size - current_chunk_offset_;
+  return true;
+}
+
+/* virtual file offset of next byte to be read */
+int64_t YProxyReader::tell() {
+  if (extent_pos_ < extent_len_) {
+    return extent_virt_off_ + extent_pos_;
+  }
+  if (order_ptr_ == order_.size()) {
+    return order_.empty() ? 0 : order_.back().start_off + order_.back().size;
+  }
+  if (current_chunk_remaining_bytes_ == 0) {
+    return order_[order_ptr_].start_off;
+  }
+  return order_[order_ptr_].start_off + current_chunk_offset_;
+}
+
+/*
+ * Read from current chunk connection at current_chunk_offset_, reopening
+ * it on failure. Returns number of bytes read, or <= 0 when out of retries.
+ */
+ssize_t YProxyReader::readStream(char *buffer, size_t amount) {
+  while (1) {
+    CHECK_FOR_INTERRUPTS();
+    if (client_fd_ == -1 && mux_stream_ == 0 && openCurrentChunk() < 0) {
+      if (++this->current_retry >= this->retry_limit) {
+        return -1;
+      }
+      backoff();
+      continue;
+    }
+
+    /* do not consume what follows chunk data on keep-alive connection */
+    amount = std::min<size_t>(amount, current_chunk_remaining_bytes_);
+    ssize_t rc;
+    if (mux_stream_ != 0) {
+      rc = readMuxStream(buffer, amount);
+    } else if (ring_ != nullptr) {
+      rc = ring_->hasPending() || waitReadable()
+               ? ring_->receive(client_fd_, buffer, amount)
+               : -1;
+    } else {
+      rc = waitReadable() ? IOEngine::get().read(client_fd_, buffer, amount)
+                          : -1;
+      ++syscalls_;
+    }
+    if (rc <= 0) {
+      elog(WARNING, "reacquiring connection on offset %lu",
+           current_chunk_offset_);
+
+      closeChunkConnection();
+
+      if (++this->current_retry < this->retry_limit) {
+        backoff();
+        (void)this->prepareYproxyConnection(order_[order_ptr_],
+                                            current_chunk_offset_);
+        continue;
+      }
+      // error, and we are out of retries.
+      return rc;
+    }
+    // what if rc > current_chunk_remaining_bytes_ ?
+    if (current_chunk_remaining_bytes_ < rc) {
+      ereport(ERROR, (errmsg_internal("yproxy returned too much data: received "
+                                      "%ld while expected <= %ld",
+                                      rc, current_chunk_remaining_bytes_)));
+    }
+    if (!reading_cache_) {
+      YezzeyIOThrottle(io_class_, rc, 0);
+    }
+    /* reset retry count, backoff grows only while no progress is made */
+    this->current_retry = 0;
+    if (cache_filler_) {
+      cache_filler_->append(buffer, rc);
+    }
+    advance(rc);
+    return rc;
+  }
+}
+
+/* sleep before next reconnection attempt */
+void YProxyReader::backoff() {
+  const auto delay = backoffDelayMs(this->current_retry, kBackoffBaseMs,
+                                    kBackoffCapMs, random());
+  pg_usleep(delay * 1000L);
+}
+
+void YProxyReader::dropHedge() {
+  if (hedge_fd_ != -1) {
+    ::close(hedge_fd_);
+    hedge_fd_ = -1;
+  }
+}
+
+/*
+ * Wait for data on current connection, up to yezzey.read_timeout.
+ *
+ * While first byte of a chunk request is awaited longer than p95 of recent
+ * requests, a duplicate Cat request for the same offset is issued and the
+ * connection which answers first is kept. Returns false on timeout.
+ */
+bool YProxyReader::waitReadable() {
+  const auto started = nowMs();
+
+  while (true) {
+    CHECK_FOR_INTERRUPTS();
+
+    const auto now = nowMs();
+    int wait = kPollSliceMs;
+    if (yezzey_read_timeout > 0) {
+      if (now - started >= yezzey_read_timeout) {
+        elog(WARNING, "yezzey: no data from yproxy within %d ms",
+             yezzey_read_timeout);
+        dropHedge();
+        return false;
+      }
+      wait = std::min<int>(wait, yezzey_read_timeout - (now - started));
+    }
+
+    if (awaiting_first_byte_ && hedge_fd_ == -1 && yezzey_hedge_reads &&
+        ring_ == nullptr &&
+        chunk_latency.size() >= kHedgeMinSamples) {
+      const auto threshold =
+          std::max(chunk_latency.percentile(0.95), kHedgeMinDelayMs);
+      const auto waited = now - request_started_ms_;
+      if (waited >= threshold) {
+        elog(yezzey_ao_log_level,
+             "yezzey: hedging request for chunk %s after %.0f ms",
+             order_[order_ptr_].x_path().c_str(), waited);
+        hedge_fd_ = issueCatRequest(order_[order_ptr_], current_chunk_offset_);
+        hedge_started_ms_ = nowMs();
+        if (hedge_fd_ == -1) {
+          /* do not try again for this request */
+          awaiting_first_byte_ = false;
+        }
+        continue;
+      }
+      wait = std::min<int>(wait, threshold - waited + 1);
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = client_fd_;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = hedge_fd_;
+    fds[1].events = POLLIN;
+    fds[1].revents = 0;
+
+    const auto rc = poll(fds, hedge_fd_ == -1 ? 1 : 2, std::max(wait, 0));
+    ++syscalls_;
+    if (rc < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      elog(WARNING, "yezzey: poll on yproxy connection failed: %m");
+      dropHedge();
+      return false;
+    }
+    if (rc == 0) {
+      continue;
+    }
+
+    if (fds[0].revents == 0 && hedge_fd_ != -1 && fds[1].revents != 0) {
+      /* duplicate request won */
+      ::close(client_fd_);
+      client_fd_ = hedge_fd_;
+      hedge_fd_ = -1;
+      request_started_ms_ = hedge_started_ms_;
+      record_latency_ = true;
+    }
+    dropHedge();
+
+    if (awaiting_first_byte_) {
+      awaiting_first_byte_ = false;
+      if (record_latency_) {
+        chunk_latency.add(nowMs() - request_started_ms_);
+      }
+    }
+    return true;
+  }
+}
+
+/* account bytes of current chunk as consumed */
+void YProxyReader::advance(size_t amount) {
+  current_chunk_remaining_bytes_ -= amount;
+  current_chunk_offset_ += amount;
+  if (current_chunk_remaining_bytes_ == 0) {
+    /* keep-alive yproxy completes Cat with ReadyForQuery */
+    if (yezzey_yproxy_keepalive && client_fd_ != -1 && !reading_cache_ &&
+        ring_ == nullptr) {
+      reusable_ =
+          commonReadRFQResponce(client_fd_, kKeepaliveRFQTimeoutMs) == 0;
+      if (!reusable_) {
+        elog(yezzey_ao_log_level,
+             "yezzey: no ReadyForQuery after chunk %s, not reusing connection",
+             order_[order_ptr_].x_path().c_str());
+      }
+    }
+    if (cache_filler_) {
+      cache_filler_->complete();
+      cache_filler_.reset();
+    }
+    ++order_ptr_;
+  }
+}
+
+/*
+ * Stage extent at current_chunk_offset_ through the shared chunk pool:
+ * either copy it from the pool, or download it and share with others.
+ */
+bool YProxyReader::fillExtent() {
+  const auto &ci = order_[order_ptr_];
+  const size_t len = std::min<int64_t>(YEZZEY_CHUNK_POOL_EXTENT,
+                                       current_chunk_remaining_bytes_);
+  const int64_t virt_off = ci.start_off + current_chunk_offset_;
+  int slot = -1;
+
+  extent_.resize(YEZZEY_CHUNK_POOL_EXTENT);
+
+  const auto res = ChunkPool::acquire(ci.x_path(), current_chunk_offset_, len,
+                                      extent_.data(), &slot);
+  if (res == ChunkPool::Result::Hit) {
+    /* stream, if any, is now behind, reopen it at next miss */
+    closeChunkConnection();
+    cache_filler_.reset();
+    advance(len);
+  } else {
+    size_t done = 0;
+    bool ok = true;
+    /* waiters for claimed slot must be released even if we error out */
+    PG_TRY();
+    {
+      while (done < len) {
+        const auto rc = readStream(extent_.data() + done, len - done);
+        if (rc <= 0) {
+          ok = false;
+          break;
+        }
+        done += rc;
+      }
+    }
+    PG_CATCH();
+    {
+      if (res == ChunkPool::Result::Claimed) {
+        ChunkPool::abandon(slot);
+      }
+      PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    if (res == ChunkPool::Result::Claimed) {
+      if (ok) {
+        ChunkPool::publish(slot, extent_.data(), len);
+      } else {
+        ChunkPool::abandon(slot);
+      }
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+
+  extent_pos_ = 0;
+  extent_len_ = len;
+  extent_virt_off_ = virt_off;
+  return true;
+}
+
 bool YProxyReader::read(char *buffer, size_t *amount) {
   // preparing done, read data
+  syscalls_ = 0;
 
   while (1) {
     CHECK_FOR_INTERRUPTS();
+    if (extent_pos_ < extent_len_) {
+      const auto n = std::min(*amount, extent_len_ - extent_pos_);
+      memcpy(buffer, extent_.data() + extent_pos_, n);
+      extent_pos_ += n;
+      *amount = n;
+      return true;
+    }
+
     if (current_chunk_remaining_bytes_ == 0) {
       // no more data to read
       if (order_ptr_ == order_.size()) {
@@ -79,50 +652,36 @@ bool YProxyReader::read(char *buffer, size_t *amount) {
       }
 
       // close previous read socket, if any
-      if (!this->close()) {
+      if (!closeChunkConnection()) {
         // wtf?
         return false;
       }
-      auto rc = this->prepareYproxyConnection(order_[order_ptr_], 0);
-      if (rc < 0) {
-        continue;
-      }
+      cache_filler_.reset();
       current_chunk_offset_ = 0;
       current_chunk_remaining_bytes_ = order_[order_ptr_].size;
     }
 
-    const auto rc = ::read(client_fd_, buffer, *amount);
-    if (rc <= 0) {
-      elog(WARNING, "reacquiring connection on offset %lu",
-           current_chunk_offset_);
-
-      ::close(client_fd_);
-      client_fd_ = -1;
-
-      if (++this->current_retry < this->retry_limit) {
-        const auto rrc = this->prepareYproxyConnection(order_[order_ptr_],
-                                                       current_chunk_offset_);
-        if (rrc < 0) {
-          sleep(1);
-          continue;
-        }
-      } else {
-        // error, and we are out of retries.
-        *amount = rc;
+    /* unaligned position (after seek) is read directly up to extent border */
+    if (ChunkPool::enabled() &&
+        current_chunk_offset_ % YEZZEY_CHUNK_POOL_EXTENT == 0) {
+      if (!fillExtent()) {
+        *amount = 0;
         return false;
       }
       continue;
     }
-    // what if rc > current_chunk_remaining_bytes_ ?
-    if (current_chunk_remaining_bytes_ < rc) {
-      ereport(ERROR, (errmsg_internal("yproxy returned too much data: received "
-                                      "%ld while expected <= %ld",
-                                      rc, current_chunk_remaining_bytes_)));
+
+    size_t want = *amount;
+    if (ChunkPool::enabled()) {
+      want = std::min<size_t>(want, YEZZEY_CHUNK_POOL_EXTENT -
+                                        current_chunk_offset_ %
+                                            YEZZEY_CHUNK_POOL_EXTENT);
     }
-    current_chunk_remaining_bytes_ -= rc;
-    current_chunk_offset_ += rc;
-    if (current_chunk_remaining_bytes_ == 0) {
-      ++order_ptr_;
+
+    const auto rc = readStream(buffer, want);
+    if (rc <= 0) {
+      *amount = rc;
+      return false;
     }
     *amount = rc;
 
@@ -130,6 +689,62 @@ bool YProxyReader::read(char *buffer, size_t *amount) {
   }
 }
 
+/*
+ * Keep reading across socket reads and chunk boundaries until the
+ * caller buffer is full or data is over. Data received before a failure
+ * is returned, the failure is reported by the next call.
+ */
+bool YProxyReader::readFull(char *buffer, size_t *amount) {
+  size_t done = 0;
+  int syscalls = 0;
+
+  while (done < *amount) {
+    size_t curr = *amount - done;
+    const auto ok = read(buffer + done, &curr);
+    syscalls += syscalls_;
+    if (!ok) {
+      if (done == 0) {
+        syscalls_ = syscalls;
+        *amount = curr;
+        return false;
+      }
+      break;
+    }
+    done += curr;
+  }
+
+  syscalls_ = syscalls;
+  *amount = done;
+  return true;
+}
+
+int YProxyReader::pollFd() {
+  if (extent_pos_ < extent_len_ || empty() || yezzey_yproxy_multiplex ||
+      ChunkPool::enabled()) {
+    return -1;
+  }
+
+  if (current_chunk_remaining_bytes_ == 0) {
+    /* same as read() does at chunk border */
+    if (!closeChunkConnection()) {
+      return -1;
+    }
+    cache_filler_.reset();
+    current_chunk_offset_ = 0;
+    current_chunk_remaining_bytes_ = order_[order_ptr_].size;
+  }
+
+  if (client_fd_ == -1 && openCurrentChunk() < 0) {
+    /* read() retries */
+    return -1;
+  }
+  if (reading_cache_ || (ring_ != nullptr && ring_->hasPending())) {
+    return -1;
+  }
+  return client_fd_;
+}
+
 bool YProxyReader::empty() {
-  return order_ptr_ == order_.size() && current_chunk_remaining_bytes_ <= 0;
+  return order_ptr_ == order_.size() && current_chunk_remaining_bytes_ <= 0 &&
+         extent_pos_ >= extent_len_;
 };
@@ -1,6 +1,11 @@
 #include "yproxy_writer.h"
+#include "gucs.h"
+#include "io_engine.h"
+#include "scope_guard.h"
 #include "url.h"
 
+#include <sys/socket.h>
+
 std::string YProxyWriter::createXPath() {
   return craftStorageUnPrefixedPath(adv_, segindx_, modcount_,
                                     insertion_rec_ptr_);
@@ -17,6 +22,9 @@ YProxyWriter::~YProxyWriter() { close(); }
 // complete external storage interaction.
 // TBD: smgr_FileSync() here ?
 bool YProxyWriter::close() {
+  if (mux_stream_ != 0) {
+    return closeMuxStream();
+  }
   if (client_fd_ == -1) {
     return true;
   }
@@ -43,23 +51,70 @@ bool YProxyWriter::close() {
     // some error, handle
     return false;
   }
-  ::close(client_fd_);
-  client_fd_ = -1;
+  reusable_ = true;
+  return YProxyConnector::close();
+}
+
+// complete Put on multiplexed stream
+bool YProxyWriter::closeMuxStream() {
+  auto streamGuard = makeScopeGuard([this] {
+    mux_->closeStream(mux_stream_);
+    mux_stream_ = 0;
+  });
+
+  if (!mux_->send(mux_stream_, CommonCostructCopyDoneRequest())) {
+    return false;
+  }
+
+  std::vector<char> msg;
+  if (!mux_->receive(mux_stream_, &msg) || parsePutComplete(msg) != 0) {
+    return false;
+  }
+  if (!mux_->receive(mux_stream_, &msg) || msg.empty() ||
+      msg[0] != MessageTypeReadyForQuery) {
+    return false;
+  }
   return true;
 }
 
 bool YProxyWriter::write(const char *buffer, size_t *amount) {
-  if (client_fd_ == -1) {
+  if (client_fd_ == -1 && mux_stream_ == 0) {
     if (prepareYproxyConnection() == -1) {
       // Throw here?
       return false;
     }
   }
 
-  // TODO: split to chunks
-  const auto msg = ConstructCopyDataRequest(buffer, *amount);
+  if (ring_ != nullptr) {
+    if (!ring_->send(client_fd_, buffer, *amount)) {
+      YProxyConnector::close();
+      *amount = 0;
+      return false;
+    }
+    return true;
+  }
+
+  if (mux_stream_ != 0) {
+    if (!mux_->send(mux_stream_, ConstructCopyDataRequest(buffer, *amount))) {
+      mux_->closeStream(mux_stream_);
+      mux_stream_ = 0;
+      *amount = 0;
+      return false;
+    }
+    return true;
+  }
+
+  /* header from stack, payload straight from caller buffer */
+  char header[COPY_DATA_HEADER_SIZE];
+  EncodeCopyDataHeader(header, *amount);
 
-  if (commonWriteFull(client_fd_, msg) == -1) {
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = COPY_DATA_HEADER_SIZE;
+  iov[1].iov_base = const_cast<char *>(buffer);
+  iov[1].iov_len = *amount;
+
+  if (IOEngine::get().writevFull(client_fd_, iov, 2) == -1) {
     // Be tidy
     ::close(client_fd_);
     client_fd_ = -1;
@@ -71,12 +126,84 @@ bool YProxyWriter::write(const char *buffer, size_t *amount) {
   return true;
 }
 
+int YProxyWriter::pollFd() {
+  /* multiplexed and ring payload can not be sent partially */
+  if (yezzey_yproxy_multiplex) {
+    return -1;
+  }
+  if (client_fd_ == -1 && prepareYproxyConnection() == -1) {
+    return -1;
+  }
+  return ring_ == nullptr ? client_fd_ : -1;
+}
+
+bool YProxyWriter::writeNonBlocking(const char *buffer, size_t amount,
+                                    size_t *sent) {
+  if (client_fd_ == -1 && prepareYproxyConnection() == -1) {
+    return false;
+  }
+
+  char header[COPY_DATA_HEADER_SIZE];
+  EncodeCopyDataHeader(header, amount);
+
+  struct iovec iov[2];
+  int iovcnt = 0;
+  if (*sent < COPY_DATA_HEADER_SIZE) {
+    iov[iovcnt].iov_base = header + *sent;
+    iov[iovcnt].iov_len = COPY_DATA_HEADER_SIZE - *sent;
+    ++iovcnt;
+  }
+  const size_t payload_sent =
+      *sent > COPY_DATA_HEADER_SIZE ? *sent - COPY_DATA_HEADER_SIZE : 0;
+  iov[iovcnt].iov_base = const_cast<char *>(buffer) + payload_sent;
+  iov[iovcnt].iov_len = amount - payload_sent;
+  ++iovcnt;
+
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = iov;
+  mh.msg_iovlen = iovcnt;
+
+  ssize_t rc;
+  do {
+    rc = sendmsg(client_fd_, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    }
+    ::close(client_fd_);
+    client_fd_ = -1;
+    return false;
+  }
+  *sent += rc;
+  return true;
+}
+
 // Initialize extental storage access guts
 int YProxyWriter::prepareYproxyConnection() {
+  if (yezzey_yproxy_multiplex) {
+    mux_ = YProxyMux::get(adv_);
+    mux_stream_ = mux_->openStream();
+    if (mux_stream_ == 0) {
+      return -1;
+    }
+    if (!mux_->send(mux_stream_, ConstructPutRequest(storage_path_))) {
+      mux_->closeStream(mux_stream_);
+      mux_stream_ = 0;
+      return -1;
+    }
+    return 0;
+  }
+
   const auto rb = YProxyConnector::prepareYproxyConnection();
   if (rb != 0) {
     return rb;
   }
+  if (setupShmRing() != 0) {
+    return -1;
+  }
 
   const auto msg = ConstructPutRequest(storage_path_);
 
@@ -121,6 +248,16 @@ int YProxyWriter::readPutCompleteResponce(int client_fd_) {
     return -1;
   }
 
+  return parsePutComplete(data);
+}
+
+// data is PutComplete message without length header
+int YProxyWriter::parsePutComplete(const std::vector<char> &data) {
+  if (data.size() != PROTO_HEADER_SIZE + 2) {
+    // protocol violation
+    return -1;
+  }
+
   if (data[0] != MessageTypePutComplete) {
     return -1;
   }
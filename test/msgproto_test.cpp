@@ -164,3 +164,86 @@ TEST(MsgBuilder, CompositeMessageLayout) {
     EXPECT_EQ(buf[str_off + i], name[i]);
   }
 }
+
+/*
+ * Stream frame wraps a complete message, length header included, after
+ * the proto header and stream id, and parses back to the same pieces.
+ */
+TEST(MsgBuilder, StreamFrameRoundTrip) {
+  auto inner = MsgBuilder()
+                   .fieldProto()
+                   .fieldUInt64()
+                   .endDescription()
+                   .addProto(MessageTypeCopyData)
+                   .addUInt64(42)
+                   .get();
+  auto frame = ConstructStreamFrame(7, inner);
+
+  ASSERT_EQ(frame.size(),
+            MSG_HEADER_SIZE + PROTO_HEADER_SIZE + UINT64_SZ + inner.size());
+  ASSERT_EQ(readBE64(frame, 0), (uint64_t)frame.size());
+  EXPECT_EQ(frame[MSG_HEADER_SIZE], MessageTypeStreamFrame);
+
+  std::vector<char> body(frame.begin() + MSG_HEADER_SIZE, frame.end());
+  uint64_t stream_id = 0;
+  size_t off = 0;
+  ASSERT_TRUE(ParseStreamFrame(body, &stream_id, &off));
+  EXPECT_EQ(stream_id, 7u);
+  EXPECT_EQ(std::vector<char>(body.begin() + off, body.end()), inner);
+}
+
+TEST(MsgBuilder, StreamFrameRejectsMalformed) {
+  auto inner = MsgBuilder().fieldProto().endDescription().addProto(
+      MessageTypeReadyForQuery);
+  auto frame = ConstructStreamFrame(1, inner.get());
+  std::vector<char> body(frame.begin() + MSG_HEADER_SIZE, frame.end());
+  uint64_t stream_id;
+  size_t off;
+
+  /* truncated wrapped message */
+  auto truncated = body;
+  truncated.pop_back();
+  EXPECT_FALSE(ParseStreamFrame(truncated, &stream_id, &off));
+
+  /* not a stream frame */
+  auto other = body;
+  other[0] = MessageTypeCopyData;
+  EXPECT_FALSE(ParseStreamFrame(other, &stream_id, &off));
+
+  /* reserved stream id */
+  auto zero = ConstructStreamFrame(0, inner.get());
+  std::vector<char> zbody(zero.begin() + MSG_HEADER_SIZE, zero.end());
+  EXPECT_FALSE(ParseStreamFrame(zbody, &stream_id, &off));
+}
+
+/* stream close carries only proto header and stream id */
+TEST(MsgBuilder, StreamClose) {
+  auto msg = ConstructStreamClose(0x0102030405060708ULL);
+
+  ASSERT_EQ(msg.size(), MSG_HEADER_SIZE + PROTO_HEADER_SIZE + UINT64_SZ);
+  EXPECT_EQ(readBE64(msg, 0), (uint64_t)msg.size());
+  EXPECT_EQ(msg[MSG_HEADER_SIZE], MessageTypeStreamClose);
+  EXPECT_EQ(readBE64(msg, MSG_HEADER_SIZE + PROTO_HEADER_SIZE),
+            0x0102030405060708ULL);
+}
+
+/* header written by EncodeCopyDataHeader must match MsgBuilder output */
+TEST(MsgBuilder, CopyDataHeaderMatchesBuilder) {
+  const std::string payload = "some payload bytes";
+  auto msg = MsgBuilder()
+                 .fieldProto()
+                 .fieldUInt64()
+                 .fieldBytes(payload.size())
+                 .endDescription()
+                 .addProto(MessageTypeCopyData)
+                 .addUInt64(payload.size())
+                 .addBytes(payload.data(), payload.size())
+                 .get();
+
+  char header[COPY_DATA_HEADER_SIZE];
+  EncodeCopyDataHeader(header, payload.size());
+
+  ASSERT_EQ(msg.size(), COPY_DATA_HEADER_SIZE + payload.size());
+  EXPECT_EQ(std::vector<char>(header, header + COPY_DATA_HEADER_SIZE),
+            std::vector<char>(msg.begin(), msg.begin() + COPY_DATA_HEADER_SIZE));
+}
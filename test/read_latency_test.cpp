@@ -0,0 +1,47 @@
+#include "gtest/gtest.h"
+
+#include "read_latency.h"
+
+TEST(LatencyTracker, EmptyWindow) {
+  LatencyTracker t;
+  EXPECT_EQ(t.size(), 0u);
+  EXPECT_EQ(t.percentile(0.95), 0);
+}
+
+TEST(LatencyTracker, Percentile) {
+  LatencyTracker t(100);
+  for (int i = 1; i <= 100; ++i) {
+    t.add(i);
+  }
+  EXPECT_EQ(t.size(), 100u);
+  EXPECT_EQ(t.percentile(0.95), 96);
+  EXPECT_EQ(t.percentile(0), 1);
+  EXPECT_EQ(t.percentile(1), 100);
+}
+
+/* old samples are overwritten once window is full */
+TEST(LatencyTracker, SlidingWindow) {
+  LatencyTracker t(4);
+  for (int i = 0; i < 4; ++i) {
+    t.add(1000);
+  }
+  for (int i = 0; i < 4; ++i) {
+    t.add(10);
+  }
+  EXPECT_EQ(t.size(), 4u);
+  EXPECT_EQ(t.percentile(1), 10);
+}
+
+TEST(Backoff, GrowsExponentially) {
+  /* rnd just below ceiling yields the ceiling bound */
+  EXPECT_EQ(backoffDelayMs(1, 100, 10000, 199), 199u);
+  EXPECT_EQ(backoffDelayMs(2, 100, 10000, 399), 399u);
+  EXPECT_EQ(backoffDelayMs(3, 100, 10000, 800), 0u);
+}
+
+TEST(Backoff, Capped) {
+  EXPECT_EQ(backoffDelayMs(10, 100, 10000, 12345), 2345u);
+  /* no overflow for large attempt numbers */
+  EXPECT_EQ(backoffDelayMs(100, 100, 10000, 12345), 2345u);
+  EXPECT_EQ(backoffDelayMs(5, 0, 0, 42), 0u);
+}
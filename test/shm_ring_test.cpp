@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+
+#include "shm_ring.h"
+
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Ring {
+  explicit Ring(size_t capacity)
+      : mem(ShmRing::mappedSize(capacity)), ring(mem.data()) {
+    ring.init(capacity);
+  }
+  std::vector<char> mem;
+  ShmRing ring;
+};
+
+} // namespace
+
+TEST(ShmRing, Empty) {
+  Ring r(16);
+  char buf[4];
+  EXPECT_EQ(r.ring.readable(), 0u);
+  EXPECT_EQ(r.ring.writable(), 16u);
+  EXPECT_EQ(r.ring.read(buf, sizeof(buf)), 0u);
+}
+
+TEST(ShmRing, WriteStopsWhenFull) {
+  Ring r(8);
+  const std::string data = "0123456789";
+  EXPECT_EQ(r.ring.write(data.data(), data.size()), 8u);
+  EXPECT_EQ(r.ring.writable(), 0u);
+  EXPECT_EQ(r.ring.write(data.data(), 1), 0u);
+
+  char buf[8];
+  ASSERT_EQ(r.ring.read(buf, sizeof(buf)), 8u);
+  EXPECT_EQ(std::string(buf, 8), "01234567");
+}
+
+/* data wrapping around the end of ring is read back in order */
+TEST(ShmRing, WrapsAround) {
+  Ring r(8);
+  char buf[8];
+
+  ASSERT_EQ(r.ring.write("abcdef", 6), 6u);
+  ASSERT_EQ(r.ring.read(buf, 4), 4u);
+  EXPECT_EQ(std::string(buf, 4), "abcd");
+
+  ASSERT_EQ(r.ring.write("ghijkl", 6), 6u);
+  EXPECT_EQ(r.ring.readable(), 8u);
+
+  ASSERT_EQ(r.ring.read(buf, 8), 8u);
+  EXPECT_EQ(std::string(buf, 8), "efghijkl");
+}
+
+TEST(ShmRing, Stream) {
+  Ring r(7);
+  std::string in, out;
+  for (int i = 0; i < 1000; ++i) {
+    in += (char)('a' + i % 26);
+  }
+
+  size_t written = 0;
+  char buf[5];
+  while (out.size() < in.size()) {
+    written += r.ring.write(in.data() + written,
+                            std::min<size_t>(3, in.size() - written));
+    const auto n = r.ring.read(buf, sizeof(buf));
+    out.append(buf, n);
+  }
+  EXPECT_EQ(in, out);
+}
@@ -0,0 +1,64 @@
+#include "gtest/gtest.h"
+
+#include "token_bucket.h"
+
+TEST(TokenBucket, DebtIsPaidByRefill) {
+  TokenBucket b;
+  tokenBucketInit(&b, 0);
+
+  /* 100 tokens at 50 per second take two seconds */
+  tokenBucketTake(&b, 100, -1);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 50), 2000);
+
+  tokenBucketRefill(&b, 1000, 50);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 50), 1000);
+
+  tokenBucketRefill(&b, 2000, 50);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 50), 0);
+}
+
+/* idle bucket accumulates at most one second of rate */
+TEST(TokenBucket, BurstIsBounded) {
+  TokenBucket b;
+  tokenBucketInit(&b, 0);
+
+  tokenBucketRefill(&b, 60000, 10);
+  EXPECT_EQ(b.tokens, 10);
+
+  tokenBucketTake(&b, 10, -1);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 10), 0);
+  tokenBucketTake(&b, 5, -1);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 10), 500);
+}
+
+TEST(TokenBucket, DebtBound) {
+  TokenBucket b;
+  tokenBucketInit(&b, 0);
+
+  tokenBucketTake(&b, 1000, 10);
+  EXPECT_EQ(b.tokens, -10);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 10), 1000);
+}
+
+TEST(TokenBucket, Unlimited) {
+  TokenBucket b;
+  tokenBucketInit(&b, 0);
+
+  tokenBucketTake(&b, 1000, -1);
+  EXPECT_EQ(tokenBucketWaitMs(&b, 0), 0);
+
+  /* debt is forgotten while there is no limit */
+  tokenBucketRefill(&b, 1, 0);
+  EXPECT_EQ(b.tokens, 0);
+}
+
+/* clock going backwards does not add tokens */
+TEST(TokenBucket, StaleClock) {
+  TokenBucket b;
+  tokenBucketInit(&b, 1000);
+
+  tokenBucketTake(&b, 10, -1);
+  tokenBucketRefill(&b, 500, 10);
+  EXPECT_EQ(b.tokens, -10);
+  EXPECT_EQ(b.last_ms, 1000);
+}
@@ -0,0 +1,44 @@
+CREATE FUNCTION yezzey_compact_relation_seg(reloid OID)
+RETURNS TABLE (status BOOLEAN)
+AS 'MODULE_PATHNAME'
+VOLATILE
+EXECUTE ON ALL SEGMENTS
+LANGUAGE C STRICT;
+
+CREATE FUNCTION
+yezzey_compact_relation(i_offload_nspname TEXT, i_offload_relname TEXT)
+RETURNS TABLE (status TEXT)
+AS $$
+DECLARE
+    v_reloid OID;
+BEGIN
+    SELECT 
+        oid
+    FROM 
+        pg_catalog.pg_class
+    INTO v_reloid 
+    WHERE 
+        relname = i_offload_relname AND relnamespace = (SELECT oid FROM pg_namespace WHERE nspname = i_offload_nspname);
+
+    IF NOT FOUND THEN
+        RAISE EXCEPTION 'relation % is not found in pg_class', i_offload_relname;
+    END IF;
+
+    PERFORM yezzey_compact_relation_seg(
+        v_reloid
+    );
+
+    RETURN QUERY SELECT ('merged small external storage chunks of relation ' || i_offload_nspname ||'.'|| i_offload_relname)::TEXT;
+END;
+$$
+LANGUAGE PLPGSQL;
+
+CREATE FUNCTION
+yezzey_compact_relation(i_offload_relname TEXT)
+RETURNS TABLE (status TEXT)
+AS $$
+BEGIN
+    RETURN QUERY SELECT yezzey_compact_relation('public', i_offload_relname);
+END;
+$$
+LANGUAGE PLPGSQL;
@@ -37,6 +37,7 @@
 #include "nodes/primnodes.h"
 
 /* storage */
+#include "storage/ipc.h"
 #include "storage/lmgr.h"
 
 /* utils */
@@ -58,6 +59,8 @@
 #include "yezzey.h"
 
 #include "binary_upgrade.h"
+#include "chunk_pool.h"
+#include "io_throttle.h"
 #include "offload.h"
 #include "offload_policy.h"
 #include "offload_tablespace_map.h"
@@ -67,6 +70,7 @@
 #include "util.h"
 #include "virtual_index.h"
 #include "virtual_tablespace.h"
+#include "worker.h"
 #include "xvacuum.h"
 
 // options for yezzey logging
@@ -79,6 +83,12 @@ static const struct config_enum_entry loglevel_options[] = {
     {"log", LOG, false},         {"fatal", FATAL, false},
     {"panic", PANIC, false},     {NULL, 0, false}};
 
+// options for yezzey.io_engine
+static const struct config_enum_entry io_engine_options[] = {
+    {"syscall", YEZZEY_IO_ENGINE_SYSCALL, false},
+    {"io_uring", YEZZEY_IO_ENGINE_URING, false},
+    {NULL, 0, false}};
+
 #define GET_STR(textp)                                                         \
   DatumGetCString(DirectFunctionCall1(textout, PointerGetDatum(textp)))
 
@@ -94,6 +104,41 @@ bool use_otm_feature = false;
 /* YPROXY */
 
 char *yproxy_socket = NULL;
+int yezzey_read_ahead_chunks = 0;
+int yezzey_read_timeout = 60 * 1000;
+bool yezzey_hedge_reads = false;
+bool yezzey_fill_read_buffer = true;
+bool yezzey_yproxy_keepalive = false;
+bool yezzey_yproxy_multiplex = false;
+int yezzey_yproxy_shm_ring_size = 0;
+int yezzey_io_engine = YEZZEY_IO_ENGINE_SYSCALL;
+int yezzey_write_buffer_size = 8192;
+int yezzey_offload_transfer_size = 4096;
+int yezzey_offload_parallel = 1;
+int yezzey_load_parallel = 1;
+int yezzey_offload_checkpoint_size = 0;
+int yezzey_compaction_target_size = 64;
+
+/* AUTO-OFFLOAD WORKER */
+char *yezzey_autooffload_database = NULL;
+int yezzey_autooffload_naptime = 60;
+int yezzey_autooffload_window_start = 0;
+int yezzey_autooffload_window_end = 24;
+int yezzey_autooffload_max_relations = 1;
+int yezzey_autooffload_parallel = 1;
+bool yezzey_autooffload_compact = false;
+
+/* LOCAL CHUNK CACHE */
+int yezzey_disk_cache_size = 0;
+char *yezzey_disk_cache_path = NULL;
+
+int yezzey_chunk_pool_size = 0;
+
+/* SEGMENT-WIDE TRAFFIC LIMITS */
+int yezzey_background_bandwidth_limit = 0;
+int yezzey_background_iops_limit = 0;
+int yezzey_foreground_bandwidth_limit = 0;
+int yezzey_foreground_iops_limit = 0;
 
 #if IsGreenplum6
 Oid runningRewriteSpcOidHint = InvalidOid;
@@ -119,6 +164,7 @@ PG_FUNCTION_INFO_V1(yezzey_show_relation_external_path);
 PG_FUNCTION_INFO_V1(yezzey_init_metadata_seg);
 PG_FUNCTION_INFO_V1(yezzey_init_metadata);
 PG_FUNCTION_INFO_V1(yezzey_set_relation_expirity_seg);
+PG_FUNCTION_INFO_V1(yezzey_compact_relation_seg);
 PG_FUNCTION_INFO_V1(yezzey_check_part_exr);
 
 PG_FUNCTION_INFO_V1(yezzey_delete_chunk);
@@ -136,6 +182,10 @@ static ExecutorStart_hook_type prev_ExecutorStart_hook = NULL;
 static ExecutorEnd_hook_type prev_ExecutorEnd_hook = NULL;
 static object_access_hook_type prev_object_access_hook = NULL;
 static ProcessUtility_hook_type prev_ProcessUtility_hook = NULL;
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
 
 /* Create yezzey metadata tables */
 Datum yezzey_init_metadata(PG_FUNCTION_ARGS) {
@@ -205,6 +255,8 @@ void yezzey_load_relation_internal(Oid reloid, const char *dest_path) {
   Oid origrelfilenode;
   /* yezzey aux index oid */
   Oid yandexoid;
+  int *segnos;
+  int nsegnos = 0;
 
 #if IsModernYezzey
   Oid segrelid;
@@ -259,14 +311,18 @@ void yezzey_load_relation_internal(Oid reloid, const char *dest_path) {
         GetAllFileSegInfo(aorel, appendOnlyMetaDataSnapshot, &total_segfiles);
 #endif
 
+    segnos = palloc(sizeof(int) * Max(total_segfiles, 1));
     for (i = 0; i < total_segfiles; i++) {
       segno = segfile_array[i]->segno;
       elog(yezzey_log_level, "loading segment no %d", segno);
 
-      loadRelationSegment(aorel, loadSpcOid, origrelfilenode, segno, dest_path);
-      /* segment if loaded */
+      segnos[nsegnos++] = segno;
     }
 
+    loadRelationSegments(aorel, loadSpcOid, origrelfilenode, segnos, nsegnos,
+                         dest_path);
+    pfree(segnos);
+
     if (segfile_array) {
       FreeAllSegFileInfo(segfile_array, total_segfiles);
       pfree(segfile_array);
@@ -281,6 +337,7 @@ void yezzey_load_relation_internal(Oid reloid, const char *dest_path) {
                                              &total_segfiles, &segrelid);
 #endif
 
+    segnos = palloc(sizeof(int) * Max(nvp * total_segfiles, 1));
     for (inat = 0; inat < nvp; ++inat) {
       for (i = 0; i < total_segfiles; i++) {
         segno = segfile_array_cs[i]->segno;
@@ -288,12 +345,14 @@ void yezzey_load_relation_internal(Oid reloid, const char *dest_path) {
         elog(yezzey_log_level, "loading cs segment no %d pseudosegno %d", segno,
              pseudosegno);
 
-        loadRelationSegment(aorel, loadSpcOid, origrelfilenode, pseudosegno,
-                            dest_path);
-        /* segment if loaded */
+        segnos[nsegnos++] = pseudosegno;
       }
     }
 
+    loadRelationSegments(aorel, loadSpcOid, origrelfilenode, segnos, nsegnos,
+                         dest_path);
+    pfree(segnos);
+
     if (segfile_array_cs) {
       FreeAllAOCSSegFileInfo(segfile_array_cs, total_segfiles);
       pfree(segfile_array_cs);
@@ -356,7 +415,7 @@ Datum yezzey_load_relation(PG_FUNCTION_ARGS) {
    * In order:
    * 1) lock table in IN EXCLUSIVE MODE (is that needed?)
    * 2) check pg_aoseg.pg_aoseg_XXX table for all segments
-   * 3) go and load each segment (XXX: enhancement: do loading in parallel)
+   * 3) go and load each segment, yezzey.load_parallel of them at once
    */
   Oid reloid;
   char *dest_path = NULL;
@@ -1237,6 +1296,27 @@ Datum yezzey_set_relation_expirity_seg(PG_FUNCTION_ARGS) {
   PG_RETURN_VOID();
 }
 
+/*
+ * yezzey_compact_relation_seg:
+ * merge small external storage chunks of offloaded relation on segment.
+ */
+Datum yezzey_compact_relation_seg(PG_FUNCTION_ARGS) {
+  Oid reloid;
+  int64 compacted;
+
+  if (GpIdentity.segindex == -1) {
+    elog(ERROR, "yezzey_compact_relation_seg should be executed on SEGMENT");
+  }
+
+  reloid = PG_GETARG_OID(0);
+  compacted = yezzey_compact_relation_internal(reloid);
+
+  elog(yezzey_log_level, "yezzey: merged %ld chunks of relation %u", compacted,
+       reloid);
+
+  PG_RETURN_VOID();
+}
+
 /* partition - related worker routines */
 
 /*
@@ -1407,6 +1487,9 @@ static void yezzey_ProcessUtility_hook(Node *parsetree, const char *queryString,
                            completionTag);
 #endif
 
+  /* e.g. COPY writes segment files outside of executor */
+  YezzeyVirtualIndexFlush();
+
   if (post_alter_offload_rel != NULL) {
 
     Relation rel = relation_openrv(post_alter_offload_rel, NoLock);
@@ -1424,6 +1507,9 @@ static void yezzey_ProcessUtility_hook(Node *parsetree, const char *queryString,
 static void yezzey_ExecuterEndHook(QueryDesc *queryDesc) {
   (void)prev_ExecutorEnd_hook(queryDesc);
 
+  /* chunks recorded by statement go to virtual index in one batch */
+  YezzeyVirtualIndexFlush();
+
   YezzeyTruncateOTMHint();
 }
 
@@ -1502,7 +1588,50 @@ static void yezzey_define_gucs() {
 
   DefineCustomBoolVariable(
       "yezzey.autooffload", "enable auto-offloading worker", NULL,
-      &yezzey_autooffload, false, PGC_USERSET, 0, NULL, NULL, NULL);
+      &yezzey_autooffload, false, PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+  DefineCustomStringVariable(
+      "yezzey.autooffload_database", "database auto-offloading worker serves",
+      NULL, &yezzey_autooffload_database, "postgres", PGC_POSTMASTER, 0, NULL,
+      NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.autooffload_naptime",
+      "time between rounds of auto-offloading worker", NULL,
+      &yezzey_autooffload_naptime, 60, 1, INT_MAX / 1000, PGC_SIGHUP,
+      GUC_UNIT_S, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.autooffload_window_start",
+      "hour of day when auto-offloading of expired relations may start",
+      "Window may wrap midnight. Equal start and end hours allow any time.",
+      &yezzey_autooffload_window_start, 0, 0, 24, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.autooffload_window_end",
+      "hour of day when auto-offloading of expired relations stops", NULL,
+      &yezzey_autooffload_window_end, 24, 0, 24, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.autooffload_max_relations",
+      "number of expired relations offloaded in one auto-offloading round",
+      NULL, &yezzey_autooffload_max_relations, 1, 1, INT_MAX, PGC_SIGHUP, 0,
+      NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.autooffload_parallel",
+      "yezzey.offload_parallel used by auto-offloading worker", NULL,
+      &yezzey_autooffload_parallel, 1, 1, 64, PGC_SIGHUP, 0, NULL, NULL,
+      NULL);
+
+  DefineCustomBoolVariable(
+      "yezzey.autooffload_compact",
+      "merge small external storage chunks of offloaded relations in "
+      "auto-offloading worker",
+      "Compaction runs within auto-offload window.",
+      &yezzey_autooffload_compact, false, PGC_SIGHUP, 0, NULL, NULL, NULL);
 
   DefineCustomEnumVariable("yezzey.log_level",
                            "Log level for yezzey functions.", NULL,
@@ -1517,6 +1646,157 @@ static void yezzey_define_gucs() {
   DefineCustomStringVariable("yezzey.yproxy_socket", "wal-g config path", NULL,
                              &yproxy_socket, "/tmp/yproxy.sock", PGC_SUSET, 0,
                              NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.read_ahead_chunks",
+      "number of external storage chunks requested ahead of the one being read",
+      "0 disables read-ahead.", &yezzey_read_ahead_chunks, 0, 0, 64,
+      PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.read_timeout",
+      "time to wait for data from yproxy before reconnecting",
+      "0 waits forever.", &yezzey_read_timeout, 60 * 1000, 0, INT_MAX,
+      PGC_USERSET, GUC_UNIT_MS, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable(
+      "yezzey.hedge_reads",
+      "duplicate chunk requests which are slower than p95 of recent ones",
+      NULL, &yezzey_hedge_reads, false, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable(
+      "yezzey.fill_read_buffer",
+      "fill whole read buffer from external storage before returning",
+      "Otherwise a read returns after first chunk of data from yproxy.",
+      &yezzey_fill_read_buffer, true, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable(
+      "yezzey.yproxy_keepalive",
+      "reuse yproxy connections for subsequent requests of backend",
+      "Requires yproxy which completes every request, including Cat, with "
+      "ReadyForQuery and keeps connection open.",
+      &yezzey_yproxy_keepalive, false, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomBoolVariable(
+      "yezzey.yproxy_multiplex",
+      "carry all yproxy reads and writes of backend over one connection",
+      "Requires yproxy which understands stream frames.",
+      &yezzey_yproxy_multiplex, false, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.yproxy_shm_ring_size",
+      "size of shared memory ring carrying data to and from yproxy, in MB",
+      "0 sends data over yproxy socket.", &yezzey_yproxy_shm_ring_size, 0, 0,
+      1024, PGC_SUSET, 0, NULL, NULL, NULL);
+
+  DefineCustomEnumVariable(
+      "yezzey.io_engine", "I/O engine used for yproxy connections",
+      "io_uring falls back to syscall when it is not available.",
+      &yezzey_io_engine, YEZZEY_IO_ENGINE_SYSCALL, io_engine_options,
+      PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.write_buffer_size",
+      "size of buffer coalescing small writes to external storage",
+      "0 sends every write to yproxy as is.", &yezzey_write_buffer_size, 8192,
+      0, 1024 * 1024, PGC_USERSET, GUC_UNIT_KB, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.offload_transfer_size",
+      "size of segment file piece read and sent to external storage at once",
+      NULL, &yezzey_offload_transfer_size, 4096, 64, 1024 * 1024, PGC_USERSET,
+      GUC_UNIT_KB, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.offload_parallel",
+      "number of segment files uploaded concurrently by relation offload",
+      "Each upload uses its own yproxy connection.", &yezzey_offload_parallel,
+      1, 1, 64, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.offload_checkpoint_size",
+      "size of separately completed parts of offloaded segment file, in MB",
+      "Failed offload is resumed from the last completed part. "
+      "0 uploads segment file as a whole.",
+      &yezzey_offload_checkpoint_size, 0, 0, INT_MAX, PGC_USERSET, 0, NULL,
+      NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.compaction_target_size",
+      "size of objects small external storage chunks are merged into, in MB",
+      "Chunks of this size or larger are left as they are.",
+      &yezzey_compaction_target_size, 64, 1, INT_MAX / 1024, PGC_USERSET, 0,
+      NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.load_parallel",
+      "number of segment files downloaded concurrently by relation load",
+      "Each download uses its own yproxy connections. Ignored with "
+      "yezzey.yproxy_multiplex or yezzey.chunk_pool_size.",
+      &yezzey_load_parallel, 1, 1, 64, PGC_USERSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.disk_cache_size",
+      "size limit of segment-local cache of external storage chunks, in MB",
+      "0 disables the cache.", &yezzey_disk_cache_size, 0, 0, INT_MAX,
+      PGC_SUSET, 0, NULL, NULL, NULL);
+
+  DefineCustomStringVariable(
+      "yezzey.disk_cache_path", "segment-local external storage chunk cache",
+      "Relative paths are resolved against the segment data directory.",
+      &yezzey_disk_cache_path, "yezzey_cache", PGC_SUSET, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.chunk_pool_size",
+      "size of shared memory pool of external storage chunks, in MB",
+      "0 disables the pool.", &yezzey_chunk_pool_size, 0, 0, INT_MAX / 2,
+      PGC_POSTMASTER, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.background_bandwidth_limit",
+      "external storage bandwidth of offload, load and vacuum on segment, "
+      "in MB/s",
+      "Query reads take this budget too. 0 does not limit the bandwidth.",
+      &yezzey_background_bandwidth_limit, 0, 0, INT_MAX / 2, PGC_SIGHUP, 0,
+      NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.background_iops_limit",
+      "external storage requests per second of offload, load and vacuum on "
+      "segment",
+      "Query reads take this budget too. 0 does not limit the rate.",
+      &yezzey_background_iops_limit, 0, 0, INT_MAX, PGC_SIGHUP, 0, NULL,
+      NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.foreground_bandwidth_limit",
+      "external storage bandwidth of query reads on segment, in MB/s",
+      "0 does not limit the bandwidth.", &yezzey_foreground_bandwidth_limit,
+      0, 0, INT_MAX / 2, PGC_SIGHUP, 0, NULL, NULL, NULL);
+
+  DefineCustomIntVariable(
+      "yezzey.foreground_iops_limit",
+      "external storage requests per second of query reads on segment",
+      "0 does not limit the rate.", &yezzey_foreground_iops_limit, 0, 0,
+      INT_MAX, PGC_SIGHUP, 0, NULL, NULL, NULL);
+}
+
+#if PG_VERSION_NUM >= 150000
+static void yezzey_shmem_request(void) {
+  if (prev_shmem_request_hook) {
+    prev_shmem_request_hook();
+  }
+  YezzeyChunkPoolShmemRequest();
+  YezzeyIOThrottleShmemRequest();
+}
+#endif
+
+static void yezzey_shmem_startup(void) {
+  if (prev_shmem_startup_hook) {
+    prev_shmem_startup_hook();
+  }
+  YezzeyChunkPoolShmemInit();
+  YezzeyIOThrottleShmemInit();
 }
 
 #if IsGreenplum6
@@ -1537,6 +1817,23 @@ void _PG_init(void) {
   /* Yezzey GUCS define */
   (void)yezzey_define_gucs();
 
+  if (process_shared_preload_libraries_in_progress) {
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = yezzey_shmem_request;
+#else
+    YezzeyChunkPoolShmemRequest();
+    YezzeyIOThrottleShmemRequest();
+#endif
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = yezzey_shmem_startup;
+
+    /* offload is dispatched from coordinator */
+    if (yezzey_autooffload && GpIdentity.segindex == -1) {
+      YezzeyAutoOffloadRegister();
+    }
+  }
+
   elog(yezzey_log_level, "[YEZZEY_SMGR] set hook");
 
   smgr_hook = smgr_yezzey;
@@ -1561,6 +1858,8 @@ void _PG_init(void) {
   ExecutorStart_hook = yezzey_ExecuterStartHook;
   ExecutorEnd_hook = yezzey_ExecuterEndHook;
 
+  RegisterXactCallback(YezzeyVirtualIndexXactCallback, NULL);
+
 #if IsModernYezzey
   /* Support? */
 #else